@@ -2,18 +2,77 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define MAX_WORD_SIZE 100
-#define BUCKET_SIZE 15331
 #define FILE_NAME "shakespeare.txt"
+#define MAX_N 5
+#define RING_SIZE 8     // a power of two, at least MAX_N
 
 // structs ==============================================
-typedef struct Node{
-    char word1[MAX_WORD_SIZE];
-    char word2[MAX_WORD_SIZE];
-    int count;
-    struct Node* next;
-} Node;
+// Every distinct word is stored once, in an arena, and known by its id.
+// Ids are handed out in the order words first appear in the file.
+typedef struct Vocab{
+    char* arena;            // the words, '\0'-terminated, back to back
+    size_t arena_used;
+    size_t arena_size;
+    size_t* offsets;        // id -> offset of the word in the arena
+    unsigned int* hashes;   // id -> word_hash of the word
+    unsigned int num_ids;
+    unsigned int max_ids;
+    unsigned int* slots;    // open addressing: id + 1, or 0 if empty
+    size_t mask;
+} Vocab;
+
+// An n-gram is n word ids and its count. In a table an entry is n + 2
+// unsigned ints: the count, 1 + the distance from its home slot (0 if the
+// slot is empty), then the ids. A bigram takes 16 bytes, where a chained
+// node with two char[100] words took over 200.
+#define ENTRY_COUNT 0
+#define ENTRY_DIST 1
+#define ENTRY_WORDS 2
+
+// Robin Hood hash table of n-grams. An entry that is further from its home
+// slot than the one in its way takes that slot, which keeps every probe
+// sequence short; the table doubles when it is 80% full.
+typedef struct NgramTable{
+    unsigned int* slots;
+    size_t mask;
+    size_t size;
+    int n;
+} NgramTable;
+
+// the counts for every n asked for, in tables[n]
+typedef struct Counts{
+    NgramTable tables[MAX_N + 1];
+    int use[MAX_N + 1];
+} Counts;
+
+// an n-gram taken out of a table to be printed; unused words are 0
+typedef struct Ngram{
+    unsigned int words[MAX_N];
+    unsigned int count;
+} Ngram;
+
+// The last words read, and the hash of the last n of them for every n up
+// to the largest in use. The hash of words x1 .. xn is the sum of
+// xi * HASH_BASE^(n-i) over their mixed ids, so sliding on by a word takes
+// a multiply and an add for each n: the oldest word is taken out and the
+// new one put in.
+typedef struct Window{
+    uint64_t mixed[RING_SIZE];  // mixed ids of the last words, as a ring
+    uint64_t hashes[MAX_N + 1];
+    long long seen;             // word i is at i % RING_SIZE
+    int max_n;
+} Window;
+
+const char* ngram_names[MAX_N + 1] = {"", "unigrams", "bigrams", "trigrams", "4-grams", "5-grams"};
 
 //wrapper functions ======================================
 int string_length(char* s){
@@ -48,153 +107,1313 @@ void remove_punctuation(char* word){
 }
 
 // functions ============================================
-//A hash function is applied to the string to create a number between 0 and s − 1, for a hash table with s buckets. 
-unsigned int hash_function(char* word1, char* word2){
+// hash of a single word; the tokenizer computes the same value on the fly
+unsigned int word_hash(char* word){
     unsigned int hash = 5381;
 
-    while(*word1){
-        hash = (hash*33) ^ *word1++;
+    while(*word){
+        hash = (hash*33) ^ (unsigned char)*word++;
     }
-    while(*word2){
-        hash = (hash*33) ^ *word2++;
+    return hash;
+}
+
+#define HASH_BASE 0x100000001b3ULL
+
+uint64_t hash_pow[MAX_N];   // HASH_BASE^i
+
+void init_hash(){
+    hash_pow[0] = 1;
+    for(int i = 1; i < MAX_N; i++){
+        hash_pow[i] = hash_pow[i - 1] * HASH_BASE;
     }
+}
 
-    return hash % BUCKET_SIZE;
+// spreads a word id (or, in approximate mode, a word hash) over 64 bits
+uint64_t hash_mix(unsigned int id){
+    uint64_t h = ((uint64_t)id + 1) * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 29);
 }
 
-//insert a new bigram into the hashtable
-void insert(Node** hashtable, char* first_w, char* second_w){
-    unsigned int hash_value = hash_function(first_w, second_w); 
-    Node* temp = hashtable[hash_value];
-    
-    //check if the node exists
-    while(temp != NULL){
-        // if the bigram already exists, increment the count
-        if(strcmp(temp->word1, first_w) == 0 && strcmp(temp->word2, second_w) == 0){
-            temp->count++;
-            return;
+// mixes a window hash so that its low bits can pick a slot
+uint64_t hash_finish(uint64_t h){
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ULL;
+    return h ^ (h >> 32);
+}
+
+// hash of a bigram of word ids. Bigrams keep this single multiply rather
+// than the window's hash, so counting bigrams alone needs no window
+uint64_t bigram_hash(unsigned int word1, unsigned int word2){
+    uint64_t key = ((uint64_t)word1 << 32) | word2;
+
+    key *= 0x9e3779b97f4a7c15ULL;
+    return key ^ (key >> 32);
+}
+
+// hash of an n-gram of word ids, the same as insert gives it
+uint64_t ngram_hash(unsigned int* words, int n){
+    uint64_t h = 0;
+
+    if(n == 2){
+        return bigram_hash(words[0], words[1]);
+    }
+
+    for(int i = 0; i < n; i++){
+        h = h * HASH_BASE + hash_mix(words[i]);
+    }
+    return hash_finish(h);
+}
+
+void window_init(Window* window, int* use){
+    memset(window, 0, sizeof(Window));
+    for(int n = 1; n <= MAX_N; n++){
+        window->max_n = use[n] ? n : window->max_n;
+    }
+}
+
+// slides the window on by a word whose mixed id is x
+void window_push(Window* window, uint64_t x){
+    for(int n = 1; n <= window->max_n; n++){
+        uint64_t out = (window->seen >= n) ? window->mixed[(window->seen - n) & (RING_SIZE - 1)] : 0;
+        window->hashes[n] = (window->hashes[n] - out * hash_pow[n - 1]) * HASH_BASE + x;
+    }
+    window->mixed[window->seen & (RING_SIZE - 1)] = x;
+    window->seen++;
+}
+
+// copies the last n of seen words out of ring, which is indexed like the
+// window's
+void window_words(unsigned int* ring, long long seen, int n, unsigned int* words){
+    for(int i = 0; i < n; i++){
+        words[i] = ring[(seen - n + i) & (RING_SIZE - 1)];
+    }
+}
+
+void vocab_init(Vocab* vocab){
+    vocab->arena_size = 1 << 16;
+    vocab->arena_used = 0;
+    vocab->arena = (char*)malloc(vocab->arena_size);
+    vocab->max_ids = 1 << 10;
+    vocab->num_ids = 0;
+    vocab->offsets = (size_t*)malloc(sizeof(size_t) * vocab->max_ids);
+    vocab->hashes = (unsigned int*)malloc(sizeof(unsigned int) * vocab->max_ids);
+    vocab->mask = 2 * vocab->max_ids - 1;
+    vocab->slots = (unsigned int*)calloc(vocab->mask + 1, sizeof(unsigned int));
+}
+
+void vocab_free(Vocab* vocab){
+    free(vocab->arena);
+    free(vocab->offsets);
+    free(vocab->hashes);
+    free(vocab->slots);
+}
+
+char* vocab_word(Vocab* vocab, unsigned int id){
+    return vocab->arena + vocab->offsets[id];
+}
+
+// makes room for one more word of up to length bytes, keeping the slots at
+// most half full
+void vocab_reserve(Vocab* vocab, size_t length){
+    while(vocab->arena_used + length + 1 > vocab->arena_size){
+        vocab->arena_size *= 2;
+        vocab->arena = (char*)realloc(vocab->arena, vocab->arena_size);
+    }
+    if(vocab->num_ids < vocab->max_ids){
+        return;
+    }
+
+    vocab->max_ids *= 2;
+    vocab->offsets = (size_t*)realloc(vocab->offsets, sizeof(size_t) * vocab->max_ids);
+    vocab->hashes = (unsigned int*)realloc(vocab->hashes, sizeof(unsigned int) * vocab->max_ids);
+    free(vocab->slots);
+    vocab->mask = 2 * vocab->max_ids - 1;
+    vocab->slots = (unsigned int*)calloc(vocab->mask + 1, sizeof(unsigned int));
+    for(unsigned int id = 0; id < vocab->num_ids; id++){
+        size_t i = vocab->hashes[id] & vocab->mask;
+        while(vocab->slots[i] != 0){
+            i = (i + 1) & vocab->mask;
         }
-        temp = temp->next;
+        vocab->slots[i] = id + 1;
     }
+}
 
-    //If it doesn't exist create a new node
-    Node* new_node = (Node*)malloc(sizeof(Node));
+// gives the next id to the word just copied to the end of the arena, which
+// is to go in slot i
+unsigned int vocab_add(Vocab* vocab, size_t i, unsigned int hash){
+    unsigned int id = vocab->num_ids++;
+    char* word = vocab->arena + vocab->arena_used;
 
-    string_copy(new_node->word1, first_w);
-    string_copy(new_node->word2, second_w);
+    vocab->offsets[id] = vocab->arena_used;
+    vocab->hashes[id] = hash;
+    vocab->arena_used += string_length(word) + 1;
+    vocab->slots[i] = id + 1;
+    return id;
+}
 
-    new_node->count = 1;
-    new_node->next = NULL;
+// id of the cleaned word s, adding it if it is new
+unsigned int vocab_intern_string(Vocab* vocab, char* s, unsigned int hash){
+    size_t length = string_length(s);
+    size_t i;
 
-    if(hashtable[hash_value] == NULL){
-        hashtable[hash_value] = new_node;
+    vocab_reserve(vocab, length);
+    for(i = hash & vocab->mask; vocab->slots[i] != 0; i = (i + 1) & vocab->mask){
+        unsigned int id = vocab->slots[i] - 1;
+        if(vocab->hashes[id] == hash && string_compare(vocab_word(vocab, id), s) == 0){
+            return id;
+        }
     }
-    else{
-        Node* temp = hashtable[hash_value];
+    memcpy(vocab->arena + vocab->arena_used, s, length + 1);
+    return vocab_add(vocab, i, hash);
+}
 
-        while(temp->next != NULL){
-            // if the bigram already exists, increment the count
-            if(string_compare(temp->word1, first_w) == 0 && string_compare(temp->word2, second_w) == 0){
-                temp->count++;
-                return;
-            }
+void table_init(NgramTable* table, int n, size_t slots){
+    table->slots = (unsigned int*)calloc(slots * (n + 2), sizeof(unsigned int));
+    table->mask = slots - 1;
+    table->size = 0;
+    table->n = n;
+}
+
+void table_free(NgramTable* table){
+    free(table->slots);
+}
+
+unsigned int* table_entry(NgramTable* table, size_t i){
+    return table->slots + i * (table->n + 2);
+}
+
+// adds count to the n-gram words whose ngram_hash is hash
+void table_add_hashed(NgramTable* table, unsigned int* words, unsigned int count, uint64_t hash);
+
+void table_grow(NgramTable* table){
+    NgramTable old = *table;
+
+    table_init(table, old.n, 2 * (old.mask + 1));
+    for(size_t i = 0; i <= old.mask; i++){
+        unsigned int* entry = table_entry(&old, i);
+        if(entry[ENTRY_DIST] != 0){
+            table_add_hashed(table, entry + ENTRY_WORDS, entry[ENTRY_COUNT], ngram_hash(entry + ENTRY_WORDS, old.n));
+        }
+    }
+    table_free(&old);
+}
+
+// table_add_hashed for a table of n-grams, with n known when it is inlined
+static inline void table_add_n(NgramTable* table, unsigned int* words, unsigned int count, uint64_t hash, int n){
+    size_t stride = n + 2;
+    size_t i = hash & table->mask;
+    unsigned int dist = 1;
 
-            // otherwise, go to the next node
-            temp = temp->next;
+    // if the n-gram already exists, increment the count. it is not after
+    // an entry nearer to its own home
+    for(;; i = (i + 1) & table->mask, dist++){
+        unsigned int* slot = table->slots + i * stride;
+        if(slot[ENTRY_DIST] < dist){
+            break;
+        }
+        int j = 0;
+        while(j < n && slot[ENTRY_WORDS + j] == words[j]){
+            j++;
+        }
+        if(j == n){
+            slot[ENTRY_COUNT] += count;
+            return;
         }
-        // if the bigram already exists and is at the end of the linked list, increment the count
-        if(string_compare(temp->word1, first_w) == 0 && string_compare(temp->word2, second_w) == 0){
-            temp->count++;
+    }
+
+    if((table->size + 1) * 5 > (table->mask + 1) * 4){
+        table_grow(table);
+        table_add_n(table, words, count, hash, n);
+        return;
+    }
+
+    // it goes in slot i; a richer entry there gives up its slot and moves
+    // on in its place
+    unsigned int entry[MAX_N + 2];
+    entry[ENTRY_COUNT] = count;
+    entry[ENTRY_DIST] = dist;
+    memcpy(entry + ENTRY_WORDS, words, sizeof(unsigned int) * n);
+    table->size++;
+    for(;; i = (i + 1) & table->mask, entry[ENTRY_DIST]++){
+        unsigned int* slot = table->slots + i * stride;
+
+        if(slot[ENTRY_DIST] == 0){
+            memcpy(slot, entry, sizeof(unsigned int) * stride);
             return;
         }
-        // if the bigram doesn't exist, add it to the end of the linked list
-        temp->next = new_node;
+        if(slot[ENTRY_DIST] < entry[ENTRY_DIST]){
+            unsigned int displaced[MAX_N + 2];
+            memcpy(displaced, slot, sizeof(unsigned int) * stride);
+            memcpy(slot, entry, sizeof(unsigned int) * stride);
+            memcpy(entry, displaced, sizeof(unsigned int) * stride);
+        }
+    }
+}
+
+void table_add_hashed(NgramTable* table, unsigned int* words, unsigned int count, uint64_t hash){
+    switch(table->n){
+        case 1: table_add_n(table, words, count, hash, 1); break;
+        case 2: table_add_n(table, words, count, hash, 2); break;
+        case 3: table_add_n(table, words, count, hash, 3); break;
+        case 4: table_add_n(table, words, count, hash, 4); break;
+        default: table_add_n(table, words, count, hash, 5); break;
+    }
+}
+
+// whether bigrams are the only n-grams counted, which are then counted
+// with insert_bigram and no window
+int bigrams_only(int* use){
+    for(int n = 1; n <= MAX_N; n++){
+        if(use[n] != (n == 2)){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// sets up a table for every n in use
+void counts_init(Counts* counts, int* use){
+    for(int n = 1; n <= MAX_N; n++){
+        counts->use[n] = use[n];
+        if(use[n]){
+            table_init(&counts->tables[n], n, 1 << 12);
+        }
+    }
+}
+
+void counts_free(Counts* counts){
+    for(int n = 1; n <= MAX_N; n++){
+        if(counts->use[n]){
+            table_free(&counts->tables[n]);
+        }
     }
 }
 
-// reads the input file and stores it into the hashtable
-void read_file_and_hash(Node** hashtable, int* num_words){
-    FILE *input_file = fopen(FILE_NAME, "r");
+//insert the n-grams ending at the newest word into the hashtables
+void insert(Counts* counts, Window* window, unsigned int* ring){
+    unsigned int words[MAX_N];
+
+    for(int n = 1; n <= window->max_n; n++){
+        if(counts->use[n] && window->seen >= n){
+            window_words(ring, window->seen, n, words);
+            uint64_t hash = (n == 2) ? bigram_hash(words[0], words[1]) : hash_finish(window->hashes[n]);
+            table_add_hashed(&counts->tables[n], words, 1, hash);
+        }
+    }
+}
+
+// insert when bigrams_only: adds the bigram (word1, word2)
+void insert_bigram(Counts* counts, unsigned int word1, unsigned int word2){
+    unsigned int words[2] = {word1, word2};
+
+    table_add_n(&counts->tables[2], words, 1, bigram_hash(word1, word2), 2);
+}
+
+// reads the input file and stores it into the hashtables
+void read_file_and_hash(Vocab* vocab, Counts* counts, int* num_words, char* file_name){
+    FILE *input_file = fopen(file_name, "r");
 
     if(input_file == NULL){
         printf("Error: File not found\n");
         exit(1);
     }
 
-    // change this to static later
-    char* first_w = malloc(sizeof(char) * MAX_WORD_SIZE);
-    char* second_w = malloc(sizeof(char) * MAX_WORD_SIZE);
+    char* word = malloc(sizeof(char) * MAX_WORD_SIZE);
+    unsigned int ring[RING_SIZE];
+    Window window;
+    window_init(&window, counts->use);
+    int bigrams = bigrams_only(counts->use);
+    unsigned int last = 0;
 
-    int word_count = 0;
     //scan first word
-    if(fscanf(input_file, "%99s", first_w) == 0){
+    int result = fscanf(input_file, "%99s", word);
+    if(result == 0){
         printf("Error: File is empty\n");
         exit(1);
     }
-     
-    while(fscanf(input_file, "%99s", second_w) == 1){
-        remove_punctuation(first_w);
-        remove_punctuation(second_w);
-        lower_case(first_w);
-        lower_case(second_w);
 
-        insert(hashtable, first_w, second_w);
-        
-        string_copy(first_w, second_w); //change the first word to the second word
-        word_count++;
+    while(result == 1){
+        remove_punctuation(word);
+        lower_case(word);
+        unsigned int id = vocab_intern_string(vocab, word, word_hash(word));
+
+        if(bigrams){
+            if(window.seen++ > 0){
+                insert_bigram(counts, last, id);
+            }
+            last = id;
+        }
+        else{
+            ring[window.seen & (RING_SIZE - 1)] = id;
+            window_push(&window, hash_mix(id));
+            insert(counts, &window, ring);
+        }
+
+        result = fscanf(input_file, "%99s", word);
+    }
+    *num_words = (window.seen > 0) ? window.seen - 1 : 0;
+}
+
+// tokenizer ============================================
+// The file is mapped into memory and scanned once. A 256-entry table gives
+// every byte its class and its lowercase form, so words are split, stripped
+// of punctuation and folded in the same pass, without copying them out of
+// the file. A word is a view of the file: where it starts, how many bytes
+// it spans there, and the hash of its cleaned form. Its bytes are only
+// copied when it is new to the vocabulary.
+// Word boundaries match fscanf("%99s") followed by remove_punctuation and
+// lower_case: a word is at most MAX_WORD_SIZE - 1 bytes of the file, and a
+// word made only of punctuation is an empty word.
+#define CLASS_WORD 0
+#define CLASS_SPACE 1
+#define CLASS_PUNCT 2
+
+typedef struct Word{
+    size_t offset;
+    int length;
+    unsigned int hash;
+} Word;
+
+unsigned char char_class[256];
+unsigned char char_fold[256];
+
+void init_char_table(){
+    for(int c = 0; c < 256; c++){
+        char_class[c] = isspace(c) ? CLASS_SPACE : ispunct(c) ? CLASS_PUNCT : CLASS_WORD;
+        char_fold[c] = (c >= 'A' && c <= 'Z') ? c - ('A' - 'a') : c;
+    }
+}
+
+// scans the word at or after *pos, up to end. returns 0 at the end
+int next_word(const unsigned char* text, size_t* pos, size_t end, Word* word){
+    size_t p = *pos;
+    unsigned int hash = 5381;
+
+    while(p < end && char_class[text[p]] == CLASS_SPACE){
+        p++;
+    }
+    if(p == end){
+        *pos = p;
+        return 0;
+    }
+
+    word->offset = p;
+    for(size_t limit = p + MAX_WORD_SIZE - 1; p < end && p < limit; p++){
+        unsigned char c = text[p];
+        if(char_class[c] == CLASS_SPACE){
+            break;
+        }
+        if(char_class[c] == CLASS_WORD){
+            hash = (hash*33) ^ char_fold[c];
+        }
+    }
+    word->length = p - word->offset;
+    word->hash = hash;
+
+    *pos = p;
+    return 1;
+}
+
+// whether the word in the file is the cleaned string s
+int word_equals(const unsigned char* text, Word* word, char* s){
+    const unsigned char* p = text + word->offset;
+    const unsigned char* end = p + word->length;
+
+    for(; p < end; p++){
+        if(char_class[*p] == CLASS_PUNCT){
+            continue;
+        }
+        if((unsigned char)*s++ != char_fold[*p]){
+            return 0;
+        }
+    }
+    return *s == '\0';
+}
+
+// copies the cleaned word into dest
+void word_copy(char* dest, const unsigned char* text, Word* word){
+    const unsigned char* p = text + word->offset;
+    const unsigned char* end = p + word->length;
+
+    for(; p < end; p++){
+        if(char_class[*p] != CLASS_PUNCT){
+            *dest++ = char_fold[*p];
+        }
+    }
+    *dest = '\0';
+}
+
+// id of the word in the file, copying it into the arena if it is new
+unsigned int vocab_intern(Vocab* vocab, const unsigned char* text, Word* word){
+    size_t i;
+
+    vocab_reserve(vocab, word->length);
+    for(i = word->hash & vocab->mask; vocab->slots[i] != 0; i = (i + 1) & vocab->mask){
+        unsigned int id = vocab->slots[i] - 1;
+        if(vocab->hashes[id] == word->hash && word_equals(text, word, vocab_word(vocab, id))){
+            return id;
+        }
+    }
+    word_copy(vocab->arena + vocab->arena_used, text, word);
+    return vocab_add(vocab, i, word->hash);
+}
+
+// parallel mode ========================================
+// The mapped file is split into one chunk per thread. Chunk boundaries are
+// moved forward to whitespace so that every word (and every %99s piece of a
+// long word) is scanned by exactly one thread, which counts the n-grams
+// inside its chunk with its own vocabulary and tables. Both are then
+// merged in parallel, split into one part per thread by hash, so that
+// every thread only ever touches the words and n-grams of its own part:
+//  - each chunk thread sorts its word ids into their parts,
+//  - each part thread interns its words from every chunk, in chunk order,
+//    and notes the chunk and id where each was first seen,
+//  - each chunk thread numbers the words first seen in it, after those
+//    first seen in earlier chunks, which gives every word the id a single
+//    pass would,
+//  - each part thread copies its words into the merged vocabulary and
+//    maps the chunks' ids of them to merged ids,
+//  - each chunk thread moves its n-grams, in merged ids, into one list per
+//    part, and each part thread adds up the lists of its part.
+// Last, the n-grams straddling each boundary (those ending at one of the
+// first n - 1 words of a chunk) are added.
+
+// a growing array of unsigned ints
+typedef struct UintList{
+    unsigned int* data;
+    size_t size;
+    size_t max;
+} UintList;
+
+typedef struct Chunk{
+    const unsigned char* text;
+    size_t start;
+    size_t end;
+    Vocab vocab;
+    Counts counts;
+    int num_parts;
+    UintList* words;            // per part, the ids of the words in it
+    unsigned int* ids;          // chunk word id -> part word id, then merged id
+    unsigned int* first_ids;    // chunk word id -> merged id if first seen
+                                // in this chunk, UINT_MAX if not
+    unsigned int first_base;    // merged id of the first word first seen here
+    UintList* entries[MAX_N + 1];   // per part, its n-grams in merged ids
+                                    // as hash (2 ints), count, n words
+    unsigned int head[MAX_N - 1];   // the first words of the chunk
+    unsigned int ring[RING_SIZE];   // the last words of the chunk, as a ring
+    long long num_words;
+} Chunk;
+
+typedef struct Merge{
+    Chunk* chunks;
+    int num_chunks;
+    Counts* counts;
+    int part;
+    Vocab vocab;                // the part's words, in order of first appearance
+    UintList firsts;            // part word id -> (chunk, chunk word id) it
+                                // was first seen at
+    unsigned int* num_firsts;   // chunk -> the part's words first seen there
+    Vocab* merged;
+    size_t arena_base;          // where the part's words go in merged's arena
+} Merge;
+
+// appends count values to list
+void list_append(UintList* list, const unsigned int* values, size_t count){
+    if(list->size + count > list->max){
+        list->max = (list->max > count) ? 2 * list->max : 2 * count + 64;
+        list->data = (unsigned int*)realloc(list->data, sizeof(unsigned int) * list->max);
+    }
+    memcpy(list->data + list->size, values, sizeof(unsigned int) * count);
+    list->size += count;
+}
+
+// runs fn on num_threads threads, thread t getting args + t * arg_size
+void run_threads(void* (*fn)(void*), void* args, size_t arg_size, int num_threads){
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+
+    for(int t = 0; t < num_threads; t++){
+        pthread_create(&threads[t], NULL, fn, (char*)args + t * arg_size);
+    }
+    for(int t = 0; t < num_threads; t++){
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+}
+// count_chunk when bigrams_only: the last word is all the window it needs
+void count_chunk_bigrams(Chunk* chunk){
+    size_t pos = chunk->start;
+    long long seen = 0;
+    unsigned int last = 0;
+    Word word;
+
+    while(next_word(chunk->text, &pos, chunk->end, &word)){
+        unsigned int id = vocab_intern(&chunk->vocab, chunk->text, &word);
+
+        if(seen < MAX_N - 1){
+            chunk->head[seen] = id;
+        }
+        chunk->ring[seen & (RING_SIZE - 1)] = id;
+        if(seen++ > 0){
+            insert_bigram(&chunk->counts, last, id);
+        }
+        last = id;
+    }
+    chunk->num_words = seen;
+}
+
+// counts the n-grams inside one chunk into its own tables
+void* count_chunk(void* arg){
+    Chunk* chunk = (Chunk*)arg;
+    size_t pos = chunk->start;
+    Window window;
+    Word word;
+
+    if(bigrams_only(chunk->counts.use)){
+        count_chunk_bigrams(chunk);
+        return NULL;
+    }
+
+    window_init(&window, chunk->counts.use);
+    while(next_word(chunk->text, &pos, chunk->end, &word)){
+        unsigned int id = vocab_intern(&chunk->vocab, chunk->text, &word);
+
+        if(window.seen < MAX_N - 1){
+            chunk->head[window.seen] = id;
+        }
+        chunk->ring[window.seen & (RING_SIZE - 1)] = id;
+        window_push(&window, hash_mix(id));
+        insert(&chunk->counts, &window, chunk->ring);
+    }
+    chunk->num_words = window.seen;
+    return NULL;
+}
+
+// which part, and so which merging thread, an n-gram or a mixed word
+// hash goes to
+int merge_part(uint64_t hash, int num_parts){
+    return (hash >> 40) % num_parts;
+}
+
+// counts a chunk, then sorts its word ids into parts
+void* count_and_split_chunk(void* arg){
+    Chunk* chunk = (Chunk*)arg;
+    Vocab* vocab = &chunk->vocab;
+
+    count_chunk(chunk);
+    chunk->words = (UintList*)calloc(chunk->num_parts, sizeof(UintList));
+    for(unsigned int id = 0; id < vocab->num_ids; id++){
+        int part = merge_part(hash_mix(vocab->hashes[id]), chunk->num_parts);
+        list_append(&chunk->words[part], &id, 1);
+    }
+    chunk->ids = (unsigned int*)malloc(sizeof(unsigned int) * (vocab->num_ids + 1));
+    chunk->first_ids = (unsigned int*)malloc(sizeof(unsigned int) * (vocab->num_ids + 1));
+    return NULL;
+}
+
+// interns the part's words of every chunk, in chunk order, into the part's
+// vocabulary, noting where each was first seen
+void* merge_vocab(void* arg){
+    Merge* merge = (Merge*)arg;
+    Vocab* vocab = &merge->vocab;
+
+    for(int c = 0; c < merge->num_chunks; c++){
+        Chunk* chunk = &merge->chunks[c];
+        UintList* words = &chunk->words[merge->part];
+
+        merge->num_firsts[c] = 0;
+        for(size_t j = 0; j < words->size; j++){
+            unsigned int id = words->data[j];
+            unsigned int num_ids = vocab->num_ids;
+
+            chunk->ids[id] = vocab_intern_string(vocab, vocab_word(&chunk->vocab, id), chunk->vocab.hashes[id]);
+            chunk->first_ids[id] = UINT_MAX;
+            if(vocab->num_ids > num_ids){
+                unsigned int first[2] = {c, id};
+                list_append(&merge->firsts, first, 2);
+                chunk->first_ids[id] = 0;
+                merge->num_firsts[c]++;
+            }
+        }
     }
-    *num_words = word_count;
+    return NULL;
 }
 
-//unhashes all values into an array
-void hash_to_array(Node** hashtable, Node** sorted_bigrams, int* size){
-    int sorted_index = 0;
-    // add all hash elements to the array
-    for(int i = 0; i < BUCKET_SIZE; i++){
-        Node* current_bigram = hashtable[i];
+// gives the words first seen in a chunk their merged ids, in chunk order
+void* number_chunk_words(void* arg){
+    Chunk* chunk = (Chunk*)arg;
+    unsigned int next = chunk->first_base;
 
-        while(current_bigram != NULL){
-            sorted_bigrams[sorted_index] = current_bigram;
-            sorted_index++;
-            current_bigram = current_bigram->next;
+    for(unsigned int id = 0; id < chunk->vocab.num_ids; id++){
+        if(chunk->first_ids[id] != UINT_MAX){
+            chunk->first_ids[id] = next++;
         }
     }
+    return NULL;
+}
+
+// copies the part's words into the merged vocabulary and maps the chunks'
+// ids of them to merged ids
+void* merge_vocab_ids(void* arg){
+    Merge* merge = (Merge*)arg;
+    Vocab* vocab = &merge->vocab;
+    Vocab* merged = merge->merged;
+    unsigned int* ids = (unsigned int*)malloc(sizeof(unsigned int) * (vocab->num_ids + 1));
 
-    *size = sorted_index;
+    memcpy(merged->arena + merge->arena_base, vocab->arena, vocab->arena_used);
+    for(unsigned int id = 0; id < vocab->num_ids; id++){
+        Chunk* chunk = &merge->chunks[merge->firsts.data[2 * id]];
+        ids[id] = chunk->first_ids[merge->firsts.data[2 * id + 1]];
+        merged->offsets[ids[id]] = merge->arena_base + vocab->offsets[id];
+        merged->hashes[ids[id]] = vocab->hashes[id];
+    }
+
+    for(int c = 0; c < merge->num_chunks; c++){
+        Chunk* chunk = &merge->chunks[c];
+        UintList* words = &chunk->words[merge->part];
+
+        for(size_t j = 0; j < words->size; j++){
+            chunk->ids[words->data[j]] = ids[chunk->ids[words->data[j]]];
+        }
+    }
+    free(ids);
+    return NULL;
 }
 
-// compare function for qsort
+// moves a chunk's n-grams, in merged ids, into the lists of their parts
+void* split_chunk_tables(void* arg){
+    Chunk* chunk = (Chunk*)arg;
+    unsigned int out[MAX_N + 3];
+
+    for(int n = 1; n <= MAX_N; n++){
+        NgramTable* table = &chunk->counts.tables[n];
+        if(!chunk->counts.use[n]){
+            continue;
+        }
+
+        chunk->entries[n] = (UintList*)calloc(chunk->num_parts, sizeof(UintList));
+        for(size_t i = 0; i <= table->mask; i++){
+            unsigned int* entry = table_entry(table, i);
+            if(entry[ENTRY_DIST] == 0){
+                continue;
+            }
+
+            for(int j = 0; j < n; j++){
+                out[3 + j] = chunk->ids[entry[ENTRY_WORDS + j]];
+            }
+            uint64_t hash = ngram_hash(out + 3, n);
+            out[0] = (unsigned int)hash;
+            out[1] = (unsigned int)(hash >> 32);
+            out[2] = entry[ENTRY_COUNT];
+            list_append(&chunk->entries[n][merge_part(hash, chunk->num_parts)], out, n + 3);
+        }
+    }
+    counts_free(&chunk->counts);
+    return NULL;
+}
+
+// adds up the part's lists of every chunk into the part's tables
+void* merge_tables(void* arg){
+    Merge* merge = (Merge*)arg;
+
+    for(int c = 0; c < merge->num_chunks; c++){
+        Chunk* chunk = &merge->chunks[c];
+
+        for(int n = 1; n <= MAX_N; n++){
+            if(!chunk->counts.use[n]){
+                continue;
+            }
+
+            UintList* list = &chunk->entries[n][merge->part];
+            for(size_t j = 0; j < list->size; j += n + 3){
+                unsigned int* out = list->data + j;
+                uint64_t hash = out[0] | ((uint64_t)out[1] << 32);
+                table_add_hashed(&merge->counts->tables[n], out + 3, out[2], hash);
+            }
+            free(list->data);
+        }
+    }
+    return NULL;
+}
+
+// maps the input file into memory and sets up the character table. an
+// empty file cannot be mapped and gives NULL, with nothing to read
+unsigned char* map_file(char* file_name, size_t* size){
+    int fd = open(file_name, O_RDONLY);
+    struct stat st;
+
+    if(fd < 0 || fstat(fd, &st) < 0){
+        printf("Error: File not found\n");
+        exit(1);
+    }
+
+    init_char_table();
+    *size = st.st_size;
+    if(*size == 0){
+        close(fd);
+        return NULL;
+    }
+    unsigned char* text = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(text == MAP_FAILED){
+        printf("Error: Could not map file\n");
+        exit(1);
+    }
+    close(fd);
+    madvise(text, *size, MADV_SEQUENTIAL);
+    return text;
+}
+
+// maps the input file and counts the n-grams for every n in use with
+// num_threads threads. the counts end up in num_threads parts that split
+// the n-grams between them
+void read_file_and_hash_parallel(Vocab* vocab, Counts* parts, int* use, int* num_words, char* file_name, int num_threads){
+    size_t size;
+    unsigned char* text = map_file(file_name, &size);
+
+    // split at whitespace, so a word is never cut in two
+    Chunk* chunks = (Chunk*)calloc(num_threads, sizeof(Chunk));
+    size_t start = 0;
+    for(int c = 0; c < num_threads; c++){
+        size_t end = (c == num_threads - 1) ? size : size / num_threads * (c + 1);
+
+        if(end < start){
+            end = start;
+        }
+        while(end < size && char_class[text[end]] != CLASS_SPACE){
+            end++;
+        }
+        chunks[c].text = text;
+        chunks[c].start = start;
+        chunks[c].end = end;
+        chunks[c].num_parts = num_threads;
+        vocab_init(&chunks[c].vocab);
+        counts_init(&chunks[c].counts, use);
+        start = end;
+    }
+
+    if(num_threads == 1){
+        // a single chunk is counted on this thread, and its vocabulary and
+        // tables are the result
+        count_chunk(&chunks[0]);
+        *vocab = chunks[0].vocab;
+        parts[0] = chunks[0].counts;
+        *num_words = (chunks[0].num_words > 0) ? chunks[0].num_words - 1 : 0;
+        free(chunks);
+        if(text != NULL){
+            munmap(text, size);
+        }
+        return;
+    }
+
+    Merge* merges = (Merge*)calloc(num_threads, sizeof(Merge));
+    for(int m = 0; m < num_threads; m++){
+        merges[m].chunks = chunks;
+        merges[m].num_chunks = num_threads;
+        merges[m].counts = &parts[m];
+        merges[m].part = m;
+        merges[m].num_firsts = (unsigned int*)malloc(sizeof(unsigned int) * num_threads);
+        merges[m].merged = vocab;
+        vocab_init(&merges[m].vocab);
+    }
+
+    run_threads(count_and_split_chunk, chunks, sizeof(Chunk), num_threads);
+    run_threads(merge_vocab, merges, sizeof(Merge), num_threads);
+
+    // merged ids, in the order words first appear in the file: the words
+    // first seen in a chunk come after those of the chunks before it
+    unsigned int num_ids = 0;
+    for(int c = 0; c < num_threads; c++){
+        chunks[c].first_base = num_ids;
+        for(int m = 0; m < num_threads; m++){
+            num_ids += merges[m].num_firsts[c];
+        }
+    }
+    size_t arena_used = 0;
+    for(int m = 0; m < num_threads; m++){
+        merges[m].arena_base = arena_used;
+        arena_used += merges[m].vocab.arena_used;
+    }
+    run_threads(number_chunk_words, chunks, sizeof(Chunk), num_threads);
+
+    // the merged vocabulary is only read by id from here on. with max_ids
+    // at num_ids and no slots filled in, vocab_reserve builds them before
+    // anything is looked up by word
+    if(num_ids > 0){
+        vocab->arena_size = arena_used;
+        vocab->arena_used = arena_used;
+        vocab->arena = (char*)malloc(arena_used);
+        vocab->num_ids = num_ids;
+        vocab->max_ids = num_ids;
+        vocab->offsets = (size_t*)malloc(sizeof(size_t) * num_ids);
+        vocab->hashes = (unsigned int*)malloc(sizeof(unsigned int) * num_ids);
+        vocab->mask = 0;
+        vocab->slots = (unsigned int*)calloc(1, sizeof(unsigned int));
+    }
+    else{
+        vocab_init(vocab);
+    }
+    run_threads(merge_vocab_ids, merges, sizeof(Merge), num_threads);
+
+    for(int m = 0; m < num_threads; m++){
+        counts_init(&parts[m], use);
+    }
+    run_threads(split_chunk_tables, chunks, sizeof(Chunk), num_threads);
+    run_threads(merge_tables, merges, sizeof(Merge), num_threads);
+
+    // the n-grams across each boundary, walking the file with a ring of
+    // the last words in merged ids
+    unsigned int ring[RING_SIZE];
+    unsigned int words[MAX_N];
+    long long seen = 0;
+    for(int c = 0; c < num_threads; c++){
+        Chunk* chunk = &chunks[c];
+        long long head = (chunk->num_words < MAX_N - 1) ? chunk->num_words : MAX_N - 1;
+        long long base = seen;
+
+        for(long long j = 0; j < head; j++){
+            ring[(base + j) & (RING_SIZE - 1)] = chunk->ids[chunk->head[j]];
+            seen = base + j + 1;
+            for(int n = j + 2; n <= MAX_N; n++){
+                if(!use[n] || seen < n){
+                    continue;
+                }
+                window_words(ring, seen, n, words);
+                uint64_t hash = ngram_hash(words, n);
+                table_add_hashed(&parts[merge_part(hash, num_threads)].tables[n], words, 1, hash);
+            }
+        }
+        for(long long j = (chunk->num_words - MAX_N > head) ? chunk->num_words - MAX_N : head; j < chunk->num_words; j++){
+            ring[(base + j) & (RING_SIZE - 1)] = chunk->ids[chunk->ring[j & (RING_SIZE - 1)]];
+        }
+        seen = base + chunk->num_words;
+    }
+
+    for(int c = 0; c < num_threads; c++){
+        vocab_free(&chunks[c].vocab);
+        free(chunks[c].ids);
+        free(chunks[c].first_ids);
+        for(int m = 0; m < num_threads; m++){
+            free(chunks[c].words[m].data);
+        }
+        free(chunks[c].words);
+        for(int n = 1; n <= MAX_N; n++){
+            free(chunks[c].entries[n]);
+        }
+    }
+    for(int m = 0; m < num_threads; m++){
+        vocab_free(&merges[m].vocab);
+        free(merges[m].firsts.data);
+        free(merges[m].num_firsts);
+    }
+    free(merges);
+    free(chunks);
+    if(text != NULL){
+        munmap(text, size);
+    }
+
+    // words - 1 bigrams, as counted by the serial version
+    *num_words = (seen > 0) ? seen - 1 : 0;
+}
+
+// compare function for qsort: by count, then by first appearance of the
+// words, so ties come out the same however the file was read
 int compare (const void * a, const void * b) {
-    return (*(Node**)b)->count - (*(Node**)a)->count;
+    const Ngram* x = (const Ngram*)a;
+    const Ngram* y = (const Ngram*)b;
+
+    if(x->count != y->count){
+        return (x->count < y->count) ? 1 : -1;
+    }
+    for(int i = 0; i < MAX_N; i++){
+        if(x->words[i] != y->words[i]){
+            return (x->words[i] < y->words[i]) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+void quick_sort(Ngram* sorted_ngrams, int array_size, size_t size, int (*compare)(const void *, const void *)){
+    qsort(sorted_ngrams, array_size, size, compare);
+}
+
+// top-K ================================================
+// Only the top k n-grams are printed, so there is no need to sort them all:
+// a heap of the best k seen so far, with the worst of them at the root,
+// is kept while the tables are scanned, and only those k are sorted.
+void sift_down(Ngram* heap, int size, int i){
+    for(;;){
+        int worst = i;
+        int left = 2*i + 1;
+        int right = left + 1;
+
+        if(left < size && compare(&heap[left], &heap[worst]) > 0){
+            worst = left;
+        }
+        if(right < size && compare(&heap[right], &heap[worst]) > 0){
+            worst = right;
+        }
+        if(worst == i){
+            return;
+        }
+        Ngram tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+void sift_up(Ngram* heap, int i){
+    while(i > 0 && compare(&heap[i], &heap[(i - 1) / 2]) > 0){
+        Ngram tmp = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+// puts the top k n-grams of the parts into top, best first
+void top_k(Counts* parts, int num_parts, int n, Ngram* top, int k, int* size){
+    int heap_size = 0;
+    Ngram ngram;
+
+    memset(&ngram, 0, sizeof(Ngram));
+    for(int t = 0; t < num_parts && k > 0; t++){
+        NgramTable* table = &parts[t].tables[n];
+
+        for(size_t i = 0; i <= table->mask; i++){
+            unsigned int* entry = table_entry(table, i);
+            if(entry[ENTRY_DIST] == 0){
+                continue;
+            }
+
+            memcpy(ngram.words, entry + ENTRY_WORDS, sizeof(unsigned int) * n);
+            ngram.count = entry[ENTRY_COUNT];
+            if(heap_size < k){
+                top[heap_size] = ngram;
+                sift_up(top, heap_size++);
+            }
+            else if(compare(&ngram, &top[0]) < 0){
+                top[0] = ngram;
+                sift_down(top, heap_size, 0);
+            }
+        }
+    }
+
+    quick_sort(top, heap_size, sizeof(Ngram), compare);
+    *size = heap_size;
+}
+
+// approximate mode =====================================
+// For inputs with more distinct n-grams than fit in memory, the heavy
+// hitters are found with the Space-Saving algorithm in a fixed number of
+// counters for each n. An n-gram that has a counter adds to it; a new one
+// takes over the counter with the smallest count, starting from that
+// count, which is recorded as its possible overcount. An n-gram is known by
+// the window hash of its word hashes and its words are kept as views of
+// the mapped file, so no vocabulary is built either. The counters are a
+// min-heap on the count, indexed by a linear-probing table of key -> heap
+// position.
+typedef struct Counter{
+    uint64_t key;
+    unsigned int count;
+    unsigned int error;     // the count may be over by up to this much
+    size_t slot;            // where the counter is in the index
+    Word words[MAX_N];
+} Counter;
+
+typedef struct HeavyHitters{
+    Counter* heap;
+    int size;
+    int capacity;
+    unsigned int* slots;    // heap position + 1, or 0 if empty
+    size_t mask;
+    long long total;        // n-grams seen
+} HeavyHitters;
+
+void heavy_init(HeavyHitters* hh, int capacity){
+    size_t slots = 1;
+
+    while(slots < 2 * (size_t)capacity){
+        slots *= 2;
+    }
+    hh->heap = (Counter*)malloc(sizeof(Counter) * capacity);
+    hh->size = 0;
+    hh->capacity = capacity;
+    hh->slots = (unsigned int*)calloc(slots, sizeof(unsigned int));
+    hh->mask = slots - 1;
+    hh->total = 0;
+}
+
+// puts the counter at heap position j
+void heavy_place(HeavyHitters* hh, Counter* counter, int j){
+    hh->heap[j] = *counter;
+    hh->slots[counter->slot] = j + 1;
+}
+
+void heavy_sift_down(HeavyHitters* hh, int i){
+    Counter counter = hh->heap[i];
+
+    for(;;){
+        int smallest = 2*i + 1;
+        if(smallest >= hh->size){
+            break;
+        }
+        if(smallest + 1 < hh->size && hh->heap[smallest + 1].count < hh->heap[smallest].count){
+            smallest++;
+        }
+        if(hh->heap[smallest].count >= counter.count){
+            break;
+        }
+        heavy_place(hh, &hh->heap[smallest], i);
+        i = smallest;
+    }
+    heavy_place(hh, &counter, i);
+}
+
+// empty slot for key, or the slot that holds it
+size_t heavy_find(HeavyHitters* hh, uint64_t key){
+    size_t i = key & hh->mask;
+
+    while(hh->slots[i] != 0 && hh->heap[hh->slots[i] - 1].key != key){
+        i = (i + 1) & hh->mask;
+    }
+    return i;
+}
+
+// empties slot i, moving back any entry after it that would otherwise no
+// longer be found
+void heavy_unindex(HeavyHitters* hh, size_t i){
+    for(size_t j = (i + 1) & hh->mask; hh->slots[j] != 0; j = (j + 1) & hh->mask){
+        Counter* counter = &hh->heap[hh->slots[j] - 1];
+        size_t home = counter->key & hh->mask;
+
+        // the entry may move back to i if its home is not in (i, j]
+        if(((j - home) & hh->mask) >= ((j - i) & hh->mask)){
+            hh->slots[i] = hh->slots[j];
+            counter->slot = i;
+            i = j;
+        }
+    }
+    hh->slots[i] = 0;
+}
+
+void heavy_add(HeavyHitters* hh, uint64_t key, Word* words){
+    size_t i = heavy_find(hh, key);
+
+    hh->total++;
+    if(hh->slots[i] != 0){
+        int j = hh->slots[i] - 1;
+        hh->heap[j].count++;
+        heavy_sift_down(hh, j);
+        return;
+    }
+
+    Counter counter;
+    counter.key = key;
+    counter.count = 1;
+    counter.error = 0;
+    counter.slot = i;
+    memcpy(counter.words, words, sizeof(counter.words));
+    if(hh->size < hh->capacity){
+        // a new counter of 1 rises above every larger count
+        heavy_place(hh, &counter, hh->size++);
+        for(int j = hh->size - 1; j > 0 && hh->heap[(j - 1) / 2].count > 1; j = (j - 1) / 2){
+            Counter parent = hh->heap[(j - 1) / 2];
+            heavy_place(hh, &hh->heap[j], (j - 1) / 2);
+            heavy_place(hh, &parent, j);
+        }
+        return;
+    }
+
+    // take over the smallest counter
+    counter.error = hh->heap[0].count;
+    counter.count = counter.error + 1;
+    heavy_unindex(hh, hh->heap[0].slot);
+    counter.slot = heavy_find(hh, key);
+    heavy_place(hh, &counter, 0);
+    heavy_sift_down(hh, 0);
+}
+
+// maps the input file and streams its n-grams through the counters of
+// their n, for every n in use
+void read_file_heavy_hitters(HeavyHitters* hh, int* use, unsigned char** text, char* file_name){
+    size_t size;
+    size_t pos = 0;
+    Word ring[RING_SIZE];
+    Word words[MAX_N];
+    Window window;
+
+    *text = map_file(file_name, &size);
+    window_init(&window, use);
+    while(next_word(*text, &pos, size, &ring[window.seen & (RING_SIZE - 1)])){
+        window_push(&window, hash_mix(ring[window.seen & (RING_SIZE - 1)].hash));
+        for(int n = 1; n <= MAX_N; n++){
+            if(!use[n] || window.seen < n){
+                continue;
+            }
+            for(int i = 0; i < n; i++){
+                words[i] = ring[(window.seen - n + i) & (RING_SIZE - 1)];
+            }
+            heavy_add(&hh[n], hash_finish(window.hashes[n]), words);
+        }
+    }
 }
 
-void quick_sort(Node** sorted_bigrams, int array_size, size_t size, int (*compare)(const void *, const void *)){
-    qsort(sorted_bigrams, array_size, sizeof(Node*), compare);
+// compare function for qsort: by count, then by guaranteed count
+int compare_counters(const void * a, const void * b) {
+    const Counter* x = (const Counter*)a;
+    const Counter* y = (const Counter*)b;
+
+    if(x->count != y->count){
+        return (x->count < y->count) ? 1 : -1;
+    }
+    if(x->error != y->error){
+        return (x->error > y->error) ? 1 : -1;
+    }
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+// reads a list of n like "2,3,4" into use
+void parse_ns(char* list, int* use){
+    int count = 0;
+
+    memset(use, 0, sizeof(int) * (MAX_N + 1));
+    while(*list != '\0'){
+        int n = strtol(list, &list, 10);
+        if(n < 1 || n > MAX_N || (*list != ',' && *list != '\0')){
+            break;
+        }
+        use[n] = 1;
+        count++;
+        list += (*list == ',') ? 1 : 0;
+    }
+    if(*list != '\0' || count == 0){
+        printf("Error: n must be between 1 and %d\n", MAX_N);
+        exit(1);
+    }
 }
 
 // main function ========================================
-int main(){
-    //initialize hash table, an array of pointers to nodes
-    Node** hashtable = (Node**)malloc(sizeof(Node*) * BUCKET_SIZE);
+// usage: bigram_opt [-t threads] [-s] [-n list] [-k top] [-a counters] [file]
+// threads defaults to the number of cores; -s reads the file with the
+// original fscanf loop instead of the mapped tokenizer; -n lists the n to
+// count n-grams for (2), all in one pass; -k sets how many of each are
+// printed (10); -a finds them approximately, in that many counters per n
+int main(int argc, char** argv){
+    char* file_name = FILE_NAME;
+    int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int use_fscanf = 0;
+    int k = 10;
+    int num_counters = 0;
+    int use[MAX_N + 1] = {0, 0, 1};
 
-    int num_words = 0;
-    read_file_and_hash(hashtable, &num_words);
+    for(int i = 1; i < argc; i++){
+        if(string_compare(argv[i], "-t") == 0 && i + 1 < argc){
+            num_threads = atoi(argv[++i]);
+        }
+        else if(string_compare(argv[i], "-s") == 0){
+            use_fscanf = 1;
+        }
+        else if(string_compare(argv[i], "-n") == 0 && i + 1 < argc){
+            parse_ns(argv[++i], use);
+        }
+        else if(string_compare(argv[i], "-k") == 0 && i + 1 < argc){
+            k = atoi(argv[++i]);
+        }
+        else if(string_compare(argv[i], "-a") == 0 && i + 1 < argc){
+            num_counters = atoi(argv[++i]);
+        }
+        else if(argv[i][0] == '-'){
+            printf("Error: Unknown option %s\n", argv[i]);
+            exit(1);
+        }
+        else{
+            file_name = argv[i];
+        }
+    }
+    if(num_threads < 1){
+        num_threads = 1;
+    }
+    if(k < 0){
+        k = 0;
+    }
+
+    init_hash();
 
-    //create array to store sorted bigrams
-    Node** sorted_bigrams = (Node**)malloc(sizeof(Node*) * num_words);
-    
-    int array_size = 0;
-    hash_to_array(hashtable, sorted_bigrams, &array_size);
+    if(num_counters > 0){
+        HeavyHitters hh[MAX_N + 1];
+        unsigned char* text;
+        char word[MAX_WORD_SIZE];
 
-    quick_sort(sorted_bigrams, array_size, sizeof(Node*), compare);
+        for(int n = 1; n <= MAX_N; n++){
+            if(use[n]){
+                heavy_init(&hh[n], num_counters);
+            }
+        }
+        read_file_heavy_hitters(hh, use, &text, file_name);
+
+        //print results; a count is at most error above the true count
+        for(int n = 1; n <= MAX_N; n++){
+            if(!use[n]){
+                continue;
+            }
+            qsort(hh[n].heap, hh[n].size, sizeof(Counter), compare_counters);
+
+            printf("Total %s seen: %lld\n", ngram_names[n], hh[n].total);
+            printf("Top %d %s (approximate, %d counters): \n", k, ngram_names[n], num_counters);
+            for(int i = 0; i < k && i < hh[n].size; i++){
+                printf("#%d:", i+1);
+                for(int j = 0; j < n; j++){
+                    word_copy(word, text, &hh[n].heap[i].words[j]);
+                    printf(" %s", word);
+                }
+                printf(" %u (error <= %u)\n", hh[n].heap[i].count, hh[n].heap[i].error);
+            }
+        }
+        return 0;
+    }
+
+    //initialize the vocabulary and the hash tables, one set per thread
+    Vocab vocab;
+    Counts* parts = (Counts*)malloc(sizeof(Counts) * num_threads);
+    int num_parts = 1;
+
+    int num_words = 0;
+    if(use_fscanf){
+        vocab_init(&vocab);
+        counts_init(&parts[0], use);
+        read_file_and_hash(&vocab, &parts[0], &num_words, file_name);
+    }
+    else{
+        read_file_and_hash_parallel(&vocab, parts, use, &num_words, file_name, num_threads);
+        num_parts = num_threads;
+    }
+
+    //create array to store the top n-grams
+    Ngram* top = (Ngram*)malloc(sizeof(Ngram) * (k + 1));
 
     //print results
-    printf("Total bigrams: %d\n", array_size);
-    printf("Top 10 bigrams: \n");
-    for(int i = 0; i < 10; i++){
-        printf("#%d: %s %s %d\n", i+1, sorted_bigrams[i]->word1, sorted_bigrams[i]->word2, sorted_bigrams[i]->count);
-    
+    for(int n = 1; n <= MAX_N; n++){
+        if(!use[n]){
+            continue;
+        }
+
+        size_t num_ngrams = 0;
+        for(int t = 0; t < num_parts; t++){
+            num_ngrams += parts[t].tables[n].size;
+        }
+        int top_size = 0;
+        top_k(parts, num_parts, n, top, k, &top_size);
+
+        printf("Total %s: %zu\n", ngram_names[n], num_ngrams);
+        printf("Top %d %s: \n", k, ngram_names[n]);
+        for(int i = 0; i < top_size; i++){
+            printf("#%d:", i+1);
+            for(int j = 0; j < n; j++){
+                printf(" %s", vocab_word(&vocab, top[i].words[j]));
+            }
+            printf(" %d\n", top[i].count);
+        }
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,83 @@
+// See LICENSE for license details.
+
+#include "cacheattr.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+count_min_sketch_t::count_min_sketch_t(size_t _top, size_t width) : total(0), top(_top) {
+    shift = 64;
+    for (size_t x = width; x > 1; x >>= 1)
+        shift--;
+    counts.assign(DEPTH * width, 0);
+}
+
+void count_min_sketch_t::add(uint64_t key) {
+    // one multiplicative hash per row, each with its own odd multiplier
+    static const uint64_t MUL[DEPTH] = {0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL,
+                                        0xd6e8feb86659fd93ULL};
+    total++;
+    uint64_t est = UINT64_MAX;
+    size_t width = counts.size() / DEPTH;
+    for (size_t r = 0; r < DEPTH; r++) {
+        uint32_t &c = counts[r * width + ((key * MUL[r]) >> shift)];
+        c += c != UINT32_MAX;
+        est = std::min<uint64_t>(est, c);
+    }
+
+    // keep the candidates for the top; a key that drops out and comes back
+    // returns with its full estimate
+    size_t min = 0;
+    for (size_t i = 0; i < heavy.size(); i++) {
+        if (heavy[i].first == key) {
+            heavy[i].second = est;
+            return;
+        }
+        if (heavy[i].second < heavy[min].second)
+            min = i;
+    }
+    if (heavy.size() < 2 * top)
+        heavy.push_back(std::make_pair(key, est));
+    else if (est > heavy[min].second)
+        heavy[min] = std::make_pair(key, est);
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> count_min_sketch_t::heaviest() const {
+    std::vector<std::pair<uint64_t, uint64_t>> h = heavy;
+    std::sort(h.begin(), h.end(), [](const std::pair<uint64_t, uint64_t> &a, const std::pair<uint64_t, uint64_t> &b) {
+        return a.second > b.second || (a.second == b.second && a.first < b.first);
+    });
+    if (h.size() > top)
+        h.resize(top);
+    return h;
+}
+
+miss_attribution_t::miss_attribution_t(size_t top, size_t range_bytes)
+    : pcs(top, WIDTH), ranges(top, WIDTH), range_shift(0) {
+    for (size_t x = range_bytes; x > 1; x >>= 1)
+        range_shift++;
+}
+
+void miss_attribution_t::print(const std::string &name) const {
+    if (pcs.total == 0)
+        return;
+
+    std::cout << std::setprecision(3) << std::fixed;
+    std::cout << name << " ";
+    std::cout << "Top Miss PCs:" << std::endl;
+    for (auto &h : pcs.heaviest()) {
+        std::cout << name << "   0x" << std::hex << std::setw(16) << std::setfill('0') << h.first << std::dec
+                  << std::setfill(' ') << "                  " << std::setw(10) << h.second << "  " << std::setw(7)
+                  << 100.0 * h.second / pcs.total << '%' << std::endl;
+    }
+    std::cout << name << " ";
+    std::cout << "Top Miss Ranges:" << std::endl;
+    for (auto &h : ranges.heaviest()) {
+        uint64_t begin = h.first << range_shift;
+        std::ostringstream range;
+        range << "0x" << std::hex << begin << "-0x" << begin + (uint64_t(1) << range_shift) - 1;
+        std::cout << name << "   " << std::left << std::setw(36) << range.str() << std::right << std::setw(10)
+                  << h.second << "  " << std::setw(7) << 100.0 * h.second / ranges.total << '%' << std::endl;
+    }
+}
@@ -0,0 +1,60 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_CACHE_ATTR_H
+#define _RISCV_CACHE_ATTR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Approximate counts of a stream of keys in fixed memory: a count-min
+// sketch of DEPTH rows of width counters, and the 2 * top keys with the
+// highest estimates seen so far. An estimate is never below the true
+// count, and exceeds it by at most a few per cent of the total with high
+// probability.
+class count_min_sketch_t
+{
+ public:
+  count_min_sketch_t(size_t top, size_t width);
+
+  void add(uint64_t key);
+  // the top heaviest keys and their estimates, heaviest first
+  std::vector<std::pair<uint64_t, uint64_t>> heaviest() const;
+
+  uint64_t total;
+
+ private:
+  static const size_t DEPTH = 4;
+
+  size_t top;
+  unsigned shift;
+  std::vector<uint32_t> counts;
+  std::vector<std::pair<uint64_t, uint64_t>> heavy;
+};
+
+// Attributes the misses of a cache to the PC of the instruction that made
+// the access and to the aligned range_bytes-sized address range it
+// touched, and prints the top of each
+class miss_attribution_t
+{
+ public:
+  miss_attribution_t(size_t top, size_t range_bytes);
+
+  void miss(uint64_t pc, uint64_t addr)
+  {
+    pcs.add(pc);
+    ranges.add(addr >> range_shift);
+  }
+  void print(const std::string& name) const;
+
+ private:
+  static const size_t WIDTH = 4096;
+
+  count_min_sketch_t pcs;
+  count_min_sketch_t ranges;
+  unsigned range_shift;
+};
+
+#endif
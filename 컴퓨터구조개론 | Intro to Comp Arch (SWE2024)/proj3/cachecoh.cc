@@ -0,0 +1,151 @@
+// See LICENSE for license details.
+
+#include "cachecoh.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+coherence_bus_t::coherence_bus_t(protocol_t _protocol)
+    : protocol(_protocol), linesz(0), lost_max(0), lost_seq(0), reads(0), read_exclusives(0), upgrades(0),
+      quiet(false) {
+}
+
+coherence_bus_t::~coherence_bus_t() {
+    if (!quiet)
+        print_stats();
+}
+
+void cache_sim_t::set_bus(coherence_bus_t *_bus) {
+    _bus->attach(this);
+}
+
+void coherence_bus_t::attach(cache_sim_t *cache) {
+    if (caches.size() == MAX_HARTS || (linesz && cache->linesz != linesz) || cache->pf ||
+        cache->sampler || cache->write_through || !cache->write_allocate || cache->vc_entries ||
+        cache->sector_valid) {
+        std::cerr << "coherent caches need the same block size, write-back and write-allocate, no prefetcher, "
+                     "sampling, victim cache or sectors, and at most "
+                  << MAX_HARTS << " harts" << std::endl;
+        exit(1);
+    }
+
+    linesz = cache->linesz;
+    cache->bus = this;
+    cache->hart = caches.size();
+    cache->name += std::to_string(caches.size());
+    caches.push_back(cache);
+    lost_max += cache->sets * cache->ways;
+}
+
+uint64_t coherence_bus_t::byte_mask(uint64_t addr, size_t bytes) const {
+    size_t chunk = std::max<size_t>(linesz / 64, 1);
+    size_t first = (addr & (linesz - 1)) / chunk;
+    size_t last = std::min<size_t>((addr & (linesz - 1)) + bytes, linesz) - 1;
+    last /= chunk;
+    return (last == 63 ? ~0ULL : (2ULL << last) - 1) & ~((1ULL << first) - 1);
+}
+
+void coherence_bus_t::invalidate_others(cache_sim_t *cache, uint64_t addr) {
+    uint64_t line_addr = addr & ~(linesz - 1);
+    for (auto other : caches) {
+        if (other == cache || !(other->invalidate(line_addr) & cache_sim_t::VALID))
+            continue;
+
+        other->coherence_invalidations++;
+        lost_t &l = lost[line_addr];
+        if (!l.harts) {
+            l.written = 0;
+            l.seq = lost_seq++;
+            lost_order.push_back(std::make_pair(line_addr, l.seq));
+        }
+        l.harts |= 1ULL << other->hart;
+    }
+
+    // forget the lines lost longest ago; a line found again and lost anew
+    // has a newer place, and its old one is only dropped
+    while (lost_order.size() > lost_max) {
+        auto l = lost.find(lost_order.front().first);
+        if (l != lost.end() && l->second.seq == lost_order.front().second)
+            lost.erase(l);
+        lost_order.pop_front();
+    }
+}
+
+void coherence_bus_t::note_write(uint64_t addr, size_t bytes) {
+    auto l = lost.find(addr & ~(linesz - 1));
+    if (l != lost.end())
+        l->second.written |= byte_mask(addr, bytes);
+}
+
+bool coherence_bus_t::miss(cache_sim_t *cache, uint64_t addr, size_t bytes, bool store, bool &shared) {
+    uint64_t line_addr = addr & ~(linesz - 1);
+
+    auto l = lost.find(line_addr);
+    if (l != lost.end() && (l->second.harts >> cache->hart & 1)) {
+        cache->coherence_misses++;
+        if (!(l->second.written & byte_mask(addr, bytes))) {
+            cache->false_sharing_misses++;
+            false_sharing[line_addr]++;
+        }
+        if (!(l->second.harts &= ~(1ULL << cache->hart)))
+            lost.erase(l);
+    }
+
+    // a dirty copy elsewhere supplies the line
+    bool supplied = false;
+    shared = false;
+    for (auto other : caches) {
+        size_t line = other == cache ? cache_sim_t::NO_LINE : other->probe_tag(line_addr);
+        if (line == cache_sim_t::NO_LINE)
+            continue;
+
+        if (other->dirty[line]) {
+            other->interventions++;
+            supplied = true;
+            if (!store && protocol == MESI) {
+                other->writebacks++;
+                other->writeback_bytes += linesz;
+                if (other->miss_handler) {
+                    if (cache->timing)
+                        other->miss_handler->timing->arrival = cache->timing->request;
+                    other->miss_handler->access(line_addr, linesz, true);
+                }
+                other->dirty[line] = 0;
+            }
+        }
+        other->shared[line] = 1;
+        shared = true;
+    }
+
+    if (store) {
+        read_exclusives++;
+        if (shared)
+            invalidate_others(cache, line_addr);
+        note_write(addr, bytes);
+        shared = false;
+    } else {
+        reads++;
+    }
+    return supplied;
+}
+
+void coherence_bus_t::print_stats() const {
+    if (reads + read_exclusives + upgrades == 0)
+        return;
+
+    std::cout << "Bus Reads:                 " << reads << std::endl;
+    std::cout << "Bus Read Exclusives:       " << read_exclusives << std::endl;
+    std::cout << "Bus Upgrades:              " << upgrades << std::endl;
+
+    std::vector<std::pair<uint64_t, uint64_t>> top(false_sharing.begin(), false_sharing.end());
+    size_t n = std::min<size_t>(TOP_LINES, top.size());
+    std::partial_sort(top.begin(), top.begin() + n, top.end(),
+                      [](const std::pair<uint64_t, uint64_t> &a, const std::pair<uint64_t, uint64_t> &b) {
+                          return a.second > b.second || (a.second == b.second && a.first < b.first);
+                      });
+    for (size_t i = 0; i < n; i++) {
+        std::cout << "Bus False Sharing 0x" << std::hex << std::setw(12) << std::setfill('0') << top[i].first
+                  << std::dec << std::setfill(' ') << ": " << top[i].second << std::endl;
+    }
+}
@@ -0,0 +1,91 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_CACHE_COH_H
+#define _RISCV_CACHE_COH_H
+
+#include "cachesim.h"
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Snooping bus that keeps the private data caches of up to 64 harts
+// coherent with MESI or MOESI. A line's state follows from its dirty and
+// shared bits: M is dirty and not shared, O dirty and shared, E clean and
+// not shared, S clean and shared. On a read miss a dirty copy elsewhere
+// supplies the data (an intervention); under MESI its owner also writes it
+// back and drops to S, under MOESI it keeps it as O. Write misses and
+// writes to shared lines invalidate every other copy.
+//
+// A miss on a line that another hart's write invalidated is a coherence
+// miss. It is a false sharing miss if none of the bytes written to the
+// line since it was invalidated overlap the bytes the missing access
+// touches. Only the lines invalidated last are remembered, as many as the
+// caches hold: a hart that lost a line longer ago would have replaced it
+// by now anyway.
+class coherence_bus_t
+{
+ public:
+  enum protocol_t { MESI, MOESI };
+
+  coherence_bus_t(protocol_t protocol);
+  ~coherence_bus_t();
+
+  // adds the next hart's cache, naming it after the hart (D$0, D$1, ...)
+  void attach(cache_sim_t* cache);
+
+  // a store hit on line of cache
+  void write_hit(cache_sim_t* cache, size_t line, uint64_t addr, size_t bytes)
+  {
+    if (cache->shared[line]) {
+      cache->upgrades++;
+      upgrades++;
+      invalidate_others(cache, addr);
+      cache->shared[line] = 0;
+    }
+    if (!lost.empty())
+      note_write(addr, bytes);
+  }
+  // a miss of cache; returns whether another cache supplied the line, and
+  // in shared whether the line is now shared
+  bool miss(cache_sim_t* cache, uint64_t addr, size_t bytes, bool store, bool& shared);
+
+  void print_stats() const;
+  void set_quiet(bool _quiet) { quiet = _quiet; }
+
+ private:
+  static const size_t MAX_HARTS = 64;
+  static const size_t TOP_LINES = 10;
+
+  // one bit per line chunk (a byte for lines up to 64 bytes)
+  uint64_t byte_mask(uint64_t addr, size_t bytes) const;
+  void invalidate_others(cache_sim_t* cache, uint64_t addr);
+  void note_write(uint64_t addr, size_t bytes);
+
+  protocol_t protocol;
+  std::vector<cache_sim_t*> caches;
+  size_t linesz;
+
+  // harts that lost a line to another hart's write, and the chunks written
+  // to it since, and seq, which tells the entry's place in lost_order from
+  // the places its line had when it was lost before
+  struct lost_t {
+    uint64_t harts;
+    uint64_t written;
+    uint64_t seq;
+  };
+  std::unordered_map<uint64_t, lost_t> lost;
+  // (line, seq) of the lines lost, oldest first, and how many to remember:
+  // the lines of all the caches
+  fifo_t<std::pair<uint64_t, uint64_t>> lost_order;
+  size_t lost_max;
+  uint64_t lost_seq;
+  std::unordered_map<uint64_t, uint64_t> false_sharing;
+
+  uint64_t reads;
+  uint64_t read_exclusives;
+  uint64_t upgrades;
+  bool quiet;
+};
+
+#endif
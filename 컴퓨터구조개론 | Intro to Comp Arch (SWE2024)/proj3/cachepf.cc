@@ -0,0 +1,121 @@
+// See LICENSE for license details.
+
+#include "cachepf.h"
+
+prefetcher_t *prefetcher_t::construct(const std::string &name, size_t linesz, size_t degree,
+                                      size_t table, size_t streams) {
+    if (name == "next")
+        return new next_line_prefetcher_t(linesz, degree ? degree : 1);
+    if (name == "stride")
+        return new stride_prefetcher_t(linesz, degree ? degree : 1, table);
+    if (name == "stream")
+        return new stream_prefetcher_t(linesz, degree ? degree : 4, streams);
+    return NULL;
+}
+
+void next_line_prefetcher_t::observe(uint64_t pc, uint64_t addr, bool miss, bool first_use, std::vector<uint64_t> &out) {
+    if (!miss && !first_use)
+        return;
+
+    uint64_t line_addr = addr & ~(linesz - 1);
+    for (size_t i = 1; i <= degree; i++)
+        out.push_back(line_addr + i * linesz);
+}
+
+stride_prefetcher_t::stride_prefetcher_t(size_t linesz, size_t degree, size_t entries)
+    : prefetcher_t(linesz, degree), table(entries, entry_t{0, 0, 0, 0}) {
+}
+
+void stride_prefetcher_t::observe(uint64_t pc, uint64_t addr, bool miss, bool first_use, std::vector<uint64_t> &out) {
+    // instruction fetches are their own PC, so they go by region like
+    // accesses with no PC; the low bit keeps PC keys and region keys apart,
+    // and zero free for empty entries
+    uint64_t key = pc && pc != addr ? pc << 1 | 1 : ((addr >> REGION_SHIFT) + 1) << 1;
+    entry_t &e = table[(key * 0x9e3779b97f4a7c15ULL >> 32) % table.size()];
+
+    if (e.key != key) {
+        e = entry_t{key, addr, 0, 0};
+        return;
+    }
+
+    int64_t stride = addr - e.last_addr;
+    e.last_addr = addr;
+    if (stride == 0)
+        return;
+
+    if (stride == e.stride) {
+        if (e.confidence < STEADY)
+            e.confidence++;
+    } else if (e.confidence > 0) {
+        e.confidence--;
+    } else {
+        e.stride = stride;
+    }
+
+    if (e.confidence < STEADY)
+        return;
+
+    // strides shorter than a line walk whole lines in the same direction
+    int64_t step = e.stride;
+    if (step > -int64_t(linesz) && step < int64_t(linesz))
+        step = step < 0 ? -int64_t(linesz) : linesz;
+
+    uint64_t line_addr = addr & ~(linesz - 1);
+    for (size_t i = 1; i <= degree; i++) {
+        uint64_t target = (addr + i * step) & ~(linesz - 1);
+        if (target != line_addr)
+            out.push_back(target);
+    }
+}
+
+stream_prefetcher_t::stream_prefetcher_t(size_t linesz, size_t degree, size_t n)
+    : prefetcher_t(linesz, degree), streams(n), now(0) {
+    for (auto &s : streams) {
+        s.next = 0;
+        s.last_use = 0;
+    }
+}
+
+bool stream_prefetcher_t::take(uint64_t line_addr, std::vector<uint64_t> &out) {
+    for (auto &s : streams) {
+        if (s.lines.empty() || s.lines.front() != line_addr)
+            continue;
+
+        s.lines.pop_front();
+        s.lines.push_back(s.next);
+        out.push_back(s.next);
+        s.next += linesz;
+        s.last_use = ++now;
+        return true;
+    }
+    return false;
+}
+
+void stream_prefetcher_t::observe(uint64_t pc, uint64_t addr, bool miss, bool first_use, std::vector<uint64_t> &out) {
+    if (!miss)
+        return;
+
+    stream_t *lru = &streams[0];
+    for (auto &s : streams) {
+        if (s.last_use < lru->last_use)
+            lru = &s;
+    }
+
+    useless += lru->lines.size();
+    lru->lines.clear();
+
+    uint64_t line_addr = addr & ~(linesz - 1);
+    for (size_t i = 1; i <= degree; i++) {
+        lru->lines.push_back(line_addr + i * linesz);
+        out.push_back(line_addr + i * linesz);
+    }
+    lru->next = line_addr + (degree + 1) * linesz;
+    lru->last_use = ++now;
+}
+
+size_t stream_prefetcher_t::buffered() const {
+    size_t n = 0;
+    for (auto &s : streams)
+        n += s.lines.size();
+    return n;
+}
@@ -0,0 +1,107 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_CACHE_PF_H
+#define _RISCV_CACHE_PF_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Hardware prefetcher models for cache_sim_t. The cache shows every demand
+// access to its prefetcher, which answers with the line addresses it wants
+// fetched. Next-line and stride prefetchers fill those lines into the cache
+// itself; stream buffers keep them aside until a miss takes them.
+class prefetcher_t
+{
+ public:
+  prefetcher_t(size_t _linesz, size_t _degree)
+    : linesz(_linesz), degree(_degree), issued(0), useful(0), late(0), useless(0) {}
+  virtual ~prefetcher_t() {}
+
+  // a demand access to addr by the instruction at pc (0 if unknown); miss
+  // is false for hits, including hits on prefetched lines (first_use),
+  // which keep tagged prefetch streams going
+  virtual void observe(uint64_t pc, uint64_t addr, bool miss, bool first_use,
+                       std::vector<uint64_t>& out) = 0;
+  // whether observe makes use of the PC
+  virtual bool wants_pc() const { return false; }
+  // whether the lines asked for go into the cache or into the prefetcher
+  virtual bool fills_cache() const { return true; }
+  // takes the line at line_addr out of the prefetcher's own buffers on a
+  // cache miss, asking for more lines through out
+  virtual bool take(uint64_t line_addr, std::vector<uint64_t>& out) { return false; }
+  // lines held by the prefetcher that were never used
+  virtual size_t buffered() const { return 0; }
+
+  // name is next, stride or stream; a zero degree picks the default
+  static prefetcher_t* construct(const std::string& name, size_t linesz, size_t degree,
+                                 size_t table, size_t streams);
+
+  size_t linesz;
+  size_t degree;
+
+  uint64_t issued;   // lines fetched from the next level
+  uint64_t useful;   // prefetched lines a demand access hit
+  uint64_t late;     // demand misses on lines still being prefetched
+  uint64_t useless;  // prefetched lines evicted or dropped unused
+};
+
+// Fetches the next degree lines after a miss or the first use of a
+// prefetched line (tagged next-line prefetching)
+class next_line_prefetcher_t : public prefetcher_t
+{
+ public:
+  next_line_prefetcher_t(size_t linesz, size_t degree) : prefetcher_t(linesz, degree) {}
+  void observe(uint64_t pc, uint64_t addr, bool miss, bool first_use, std::vector<uint64_t>& out);
+};
+
+// Reference prediction table (Chen and Baer). Entries are keyed by the PC
+// of the load or store and remember its last address and stride; once a
+// stride repeats, the next degree strides ahead are fetched. Instruction
+// fetches and accesses with no PC (cachesweep, cachetune) are keyed by
+// their 4 KiB region instead.
+class stride_prefetcher_t : public prefetcher_t
+{
+ public:
+  stride_prefetcher_t(size_t linesz, size_t degree, size_t entries);
+  void observe(uint64_t pc, uint64_t addr, bool miss, bool first_use, std::vector<uint64_t>& out);
+  bool wants_pc() const { return true; }
+
+ private:
+  static const unsigned REGION_SHIFT = 12;
+  static const uint8_t STEADY = 2;
+
+  struct entry_t {
+    uint64_t key;
+    uint64_t last_addr;
+    int64_t stride;
+    uint8_t confidence;
+  };
+  std::vector<entry_t> table;
+};
+
+// Stream buffers (Jouppi). A miss that no buffer head matches restarts the
+// least recently used buffer with the degree lines after it; a miss on a
+// buffer head is served from the buffer, which then fetches one more line.
+class stream_prefetcher_t : public prefetcher_t
+{
+ public:
+  stream_prefetcher_t(size_t linesz, size_t degree, size_t streams);
+  void observe(uint64_t pc, uint64_t addr, bool miss, bool first_use, std::vector<uint64_t>& out);
+  bool fills_cache() const { return false; }
+  bool take(uint64_t line_addr, std::vector<uint64_t>& out);
+  size_t buffered() const;
+
+ private:
+  struct stream_t {
+    std::deque<uint64_t> lines;
+    uint64_t next;
+    uint64_t last_use;
+  };
+  std::vector<stream_t> streams;
+  uint64_t now;
+};
+
+#endif
@@ -0,0 +1,268 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_CACHE_REPL_H
+#define _RISCV_CACHE_REPL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Replacement policies for sa_cache_sim_t and fa_cache_sim_t. A policy keeps
+// its state in flat arrays indexed by set * ways + way and provides
+//   void init(size_t sets, size_t ways);
+//   void touch(size_t set, size_t way);   a hit on way
+//   size_t victim(size_t set);            the way to evict on a miss
+//   void fill(size_t set, size_t way);    way was just refilled
+//   void invalidate(size_t set, size_t way);  way was emptied; evict it soon
+// The caches are templates on the policy, so these calls are inlined into
+// check_tag and victimize instead of going through a virtual interface.
+
+class lfsr_t
+{
+ public:
+  lfsr_t() : reg(1) {}
+  lfsr_t(const lfsr_t& lfsr) : reg(lfsr.reg) {}
+  uint32_t next() { return reg = (reg>>1)^(-(reg&1) & 0xd0000001); }
+ private:
+  uint32_t reg;
+};
+
+// Exact LRU. Each set is a circular doubly-linked recency list threaded
+// through its ways, whose head is the MRU way, so the LRU way is head->prev
+// and both promoting a hit and picking a victim are O(1).
+class lru_repl_t
+{
+ public:
+  void init(size_t sets, size_t _ways)
+  {
+    ways = _ways;
+    prev.resize(sets * ways);
+    next.resize(sets * ways);
+    head.assign(sets, ways - 1);
+
+    // MRU to LRU order is ways-1, ..., 1, 0, so empty ways fill from way 0
+    for (size_t s = 0; s < sets; s++) {
+      for (size_t w = 0; w < ways; w++) {
+        next[s * ways + w] = (w + ways - 1) % ways;
+        prev[s * ways + w] = (w + 1) % ways;
+      }
+    }
+  }
+  size_t victim(size_t set) const { return prev[set * ways + head[set]]; }
+  void fill(size_t set, size_t way) { touch(set, way); }
+  void touch(size_t set, size_t way)
+  {
+    uint32_t* p = &prev[set * ways];
+    uint32_t* n = &next[set * ways];
+    uint32_t h = head[set];
+    if (way == h)
+      return;
+    if (way != p[h]) {
+      // unlink and reinsert just before the head (i.e. at the LRU end)
+      n[p[way]] = n[way];
+      p[n[way]] = p[way];
+      p[way] = p[h];
+      n[way] = h;
+      n[p[h]] = way;
+      p[h] = way;
+    }
+    // the LRU way becomes the MRU way by rotating the head backwards
+    head[set] = way;
+  }
+  void invalidate(size_t set, size_t way)
+  {
+    uint32_t* p = &prev[set * ways];
+    uint32_t* n = &next[set * ways];
+    uint32_t h = head[set];
+    if (way == p[h])
+      return;
+    if (way == h) {
+      // rotating the head forwards makes the MRU way the LRU way
+      head[set] = n[h];
+      return;
+    }
+    n[p[way]] = n[way];
+    p[n[way]] = p[way];
+    p[way] = p[h];
+    n[way] = h;
+    n[p[h]] = way;
+    p[h] = way;
+  }
+ private:
+  size_t ways;
+  std::vector<uint32_t> prev;
+  std::vector<uint32_t> next;
+  std::vector<uint32_t> head;
+};
+
+// Exact LRU that stamps every access and scans the set's stamps on a miss
+class lru_ts_repl_t
+{
+ public:
+  void init(size_t sets, size_t _ways)
+  {
+    ways = _ways;
+    time_stamp.assign(sets * ways, 0);
+    curr_time = 0;
+  }
+  size_t victim(size_t set) const
+  {
+    const uint64_t* ts = &time_stamp[set * ways];
+    size_t lru_index = 0;
+    for (size_t i = 1; i < ways; i++)
+      if (ts[i] < ts[lru_index])
+        lru_index = i;
+    return lru_index;
+  }
+  void fill(size_t set, size_t way) { touch(set, way); }
+  void touch(size_t set, size_t way) { time_stamp[set * ways + way] = curr_time++; }
+  void invalidate(size_t set, size_t way) { time_stamp[set * ways + way] = 0; }
+ private:
+  size_t ways;
+  std::vector<uint64_t> time_stamp;
+  uint64_t curr_time;
+};
+
+// Spike's original policy: a pseudo-random way from an LFSR
+class random_repl_t
+{
+ public:
+  void init(size_t sets, size_t _ways) { ways = _ways; }
+  size_t victim(size_t set) { return lfsr.next() % ways; }
+  void fill(size_t set, size_t way) {}
+  void touch(size_t set, size_t way) {}
+  void invalidate(size_t set, size_t way) {}
+ private:
+  size_t ways;
+  lfsr_t lfsr;
+};
+
+// Round-robin over the ways of each set, ignoring hits
+class fifo_repl_t
+{
+ public:
+  void init(size_t sets, size_t _ways)
+  {
+    ways = _ways;
+    head.assign(sets, 0);
+  }
+  size_t victim(size_t set) const { return head[set]; }
+  void fill(size_t set, size_t way) { head[set] = way + 1 == ways ? 0 : way + 1; }
+  void touch(size_t set, size_t way) {}
+  void invalidate(size_t set, size_t way) {}
+ private:
+  size_t ways;
+  std::vector<uint32_t> head;
+};
+
+// Tree pseudo-LRU for a power-of-two number of ways. Node n of a set's
+// binary tree (root 1, children 2n and 2n+1, leaves ways..2*ways-1) points
+// towards the half that was used less recently.
+class plru_repl_t
+{
+ public:
+  void init(size_t sets, size_t _ways)
+  {
+    ways = _ways;
+    tree.assign(sets * ways, 0);
+  }
+  size_t victim(size_t set) const
+  {
+    const uint8_t* t = &tree[set * ways];
+    size_t n = 1;
+    while (n < ways)
+      n = 2 * n + t[n];
+    return n - ways;
+  }
+  void fill(size_t set, size_t way) { touch(set, way); }
+  void touch(size_t set, size_t way)
+  {
+    uint8_t* t = &tree[set * ways];
+    // walk up from the leaf, pointing every ancestor at the other half
+    for (size_t n = way + ways; n > 1; n >>= 1)
+      t[n >> 1] = !(n & 1);
+  }
+  void invalidate(size_t set, size_t way)
+  {
+    uint8_t* t = &tree[set * ways];
+    for (size_t n = way + ways; n > 1; n >>= 1)
+      t[n >> 1] = n & 1;
+  }
+ private:
+  size_t ways;
+  std::vector<uint8_t> tree;
+};
+
+// Re-reference interval prediction with 2-bit RRPVs (Jaleel et al.). Hits
+// predict a near re-reference; refills predict a long one (SRRIP) or, for
+// BRRIP, a distant one except for one refill in 32.
+template <bool bimodal>
+class rrip_repl_t
+{
+ public:
+  static const uint8_t RRPV_MAX = 3;
+
+  void init(size_t sets, size_t _ways)
+  {
+    ways = _ways;
+    rrpv.assign(sets * ways, uint8_t(RRPV_MAX));
+  }
+  size_t victim(size_t set)
+  {
+    uint8_t* r = &rrpv[set * ways];
+    while (true) {
+      for (size_t i = 0; i < ways; i++)
+        if (r[i] == RRPV_MAX)
+          return i;
+      for (size_t i = 0; i < ways; i++)
+        r[i]++;
+    }
+  }
+  void fill(size_t set, size_t way)
+  {
+    bool distant = bimodal && lfsr.next() % 32 != 0;
+    rrpv[set * ways + way] = distant ? RRPV_MAX : RRPV_MAX - 1;
+  }
+  void touch(size_t set, size_t way) { rrpv[set * ways + way] = 0; }
+  void invalidate(size_t set, size_t way) { rrpv[set * ways + way] = RRPV_MAX; }
+ private:
+  size_t ways;
+  std::vector<uint8_t> rrpv;
+  lfsr_t lfsr;
+};
+
+typedef rrip_repl_t<false> srrip_repl_t;
+typedef rrip_repl_t<true> brrip_repl_t;
+
+// Least frequently used, with saturating per-line hit counts that restart
+// on refill. Empty ways have a zero count, so they are filled first.
+class lfu_repl_t
+{
+ public:
+  void init(size_t sets, size_t _ways)
+  {
+    ways = _ways;
+    count.assign(sets * ways, 0);
+  }
+  size_t victim(size_t set) const
+  {
+    const uint32_t* c = &count[set * ways];
+    size_t lfu_index = 0;
+    for (size_t i = 1; i < ways; i++)
+      if (c[i] < c[lfu_index])
+        lfu_index = i;
+    return lfu_index;
+  }
+  void fill(size_t set, size_t way) { count[set * ways + way] = 1; }
+  void touch(size_t set, size_t way)
+  {
+    uint32_t& c = count[set * ways + way];
+    c += c != UINT32_MAX;
+  }
+  void invalidate(size_t set, size_t way) { count[set * ways + way] = 0; }
+ private:
+  size_t ways;
+  std::vector<uint32_t> count;
+};
+
+#endif
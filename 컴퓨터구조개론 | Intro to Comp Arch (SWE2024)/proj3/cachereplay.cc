@@ -0,0 +1,188 @@
+// See LICENSE for license details.
+
+// Replays a trace recorded with --trace-out through the cache simulator.
+// Takes the same cache options as spike, so a configuration search only
+// needs to run the RISC-V program once.
+
+#include "cachesim.h"
+#include "cachecoh.h"
+#include "cachetrace.h"
+#include "tlbsim.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+static void help() {
+    std::cerr << "usage: cachereplay [options] <trace file>" << std::endl;
+    std::cerr << "  --ic=<S>:<W>:<B>        Instruction cache" << std::endl;
+    std::cerr << "  --dc=<S>:<W>:<B>        Data cache" << std::endl;
+    std::cerr << "  --l2=<S>:<W>:<B>        L2 cache behind the I$ and D$" << std::endl;
+    std::cerr << "  --l3=<S>:<W>:<B>        L3 cache behind the L2" << std::endl;
+    std::cerr << "  --dc-sweep=<config,...> Data cache configurations simulated together" << std::endl;
+    std::cerr << "  --coherence=mesi|moesi  One --dc per hart, kept coherent on a bus" << std::endl;
+    std::cerr << "  --dtlb=<E>:<W>          Data TLB of E entries, W ways" << std::endl;
+    std::cerr << "  --stlb=<E>:<W>          Second level TLB behind the data TLB" << std::endl;
+    std::cerr << "  --page=4k|2m            TLB page size; page walks read the page table" << std::endl;
+    std::cerr << "                          through the D$ (default 4k)" << std::endl;
+    std::cerr << "  --log-cache-miss        Print every cache miss" << std::endl;
+    std::cerr << "  --stats-insns=<n>       End a stats interval every n instructions, for the" << std::endl;
+    std::cerr << "                          caches given stats=<path>" << std::endl;
+    exit(1);
+}
+
+static const char *option(const char *arg, const char *name) {
+    size_t n = strlen(name);
+    return strncmp(arg, name, n) == 0 ? arg + n : NULL;
+}
+
+int main(int argc, char **argv) {
+    std::unique_ptr<icache_sim_t> ic;
+    std::unique_ptr<dcache_sim_t> dc;
+    std::unique_ptr<cache_sim_t> l2;
+    std::unique_ptr<cache_sim_t> l3;
+    std::unique_ptr<dcache_sweep_sim_t> dcs;
+    std::unique_ptr<coherence_bus_t> bus;
+    const char *dc_config = NULL;
+    const char *dtlb_config = NULL;
+    const char *stlb_config = NULL;
+    const char *page = "4k";
+    bool log_cache = false;
+    uint64_t stats_insns = 0;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *s;
+        if ((s = option(argv[i], "--ic=")))
+            ic.reset(new icache_sim_t(s));
+        else if ((s = option(argv[i], "--dc=")))
+            dc_config = s;
+        else if ((s = option(argv[i], "--l2=")))
+            l2.reset(cache_sim_t::construct(s, "L2$"));
+        else if ((s = option(argv[i], "--l3=")))
+            l3.reset(cache_sim_t::construct(s, "L3$"));
+        else if ((s = option(argv[i], "--dc-sweep=")))
+            dcs.reset(new dcache_sweep_sim_t(s));
+        else if ((s = option(argv[i], "--coherence=")) && !strcmp(s, "mesi"))
+            bus.reset(new coherence_bus_t(coherence_bus_t::MESI));
+        else if ((s = option(argv[i], "--coherence=")) && !strcmp(s, "moesi"))
+            bus.reset(new coherence_bus_t(coherence_bus_t::MOESI));
+        else if ((s = option(argv[i], "--dtlb=")))
+            dtlb_config = s;
+        else if ((s = option(argv[i], "--stlb=")))
+            stlb_config = s;
+        else if ((s = option(argv[i], "--page=")))
+            page = s;
+        else if (!strcmp(argv[i], "--log-cache-miss"))
+            log_cache = true;
+        else if ((s = option(argv[i], "--stats-insns=")) && atoll(s) > 0)
+            stats_insns = atoll(s);
+        else if (argv[i][0] == '-' || path)
+            help();
+        else
+            path = argv[i];
+    }
+    if (!path || (l3 && !l2) || (bus && !dc_config) || (stlb_config && !dtlb_config) || (bus && dtlb_config))
+        help();
+    if (dc_config && !bus)
+        dc.reset(new dcache_sim_t(dc_config));
+
+    if (l2 && l3)
+        l2->set_miss_handler(&*l3);
+    if (dc && l2)
+        dc->set_miss_handler(&*l2);
+    if (ic && l2)
+        ic->set_miss_handler(&*l2);
+    if (ic)
+        ic->set_log(log_cache);
+    if (dc)
+        dc->set_log(log_cache);
+
+    // declared after the caches so the TLBs print their stats first
+    std::unique_ptr<page_walker_t> walker;
+    std::unique_ptr<tlb_sim_t> stlb;
+    std::unique_ptr<tlb_sim_t> dtlb;
+    std::unique_ptr<dtlb_sim_t> dtlb_tracer;
+    if (dtlb_config) {
+        walker.reset(new page_walker_t(dc ? dc->get_cache() : NULL, "DTLB"));
+        dtlb.reset(tlb_sim_t::construct(dtlb_config, page, "DTLB"));
+        if (stlb_config) {
+            stlb.reset(tlb_sim_t::construct(stlb_config, page, "STLB"));
+            dtlb->set_miss_handler(&*stlb);
+            stlb->set_walker(&*walker);
+        } else {
+            dtlb->set_walker(&*walker);
+        }
+        dtlb_tracer.reset(new dtlb_sim_t(&*dtlb));
+    }
+
+    memtracer_list_t tracers;
+    if (ic)
+        tracers.hook(&*ic);
+    if (dtlb_tracer)
+        tracers.hook(&*dtlb_tracer);
+    if (dc)
+        tracers.hook(&*dc);
+    if (dcs)
+        tracers.hook(&*dcs);
+
+    cache_trace_t trace(path);
+    cache_trace_reader_t reader(trace);
+
+    // each hart's loads and stores go to its own D$, made on its first record;
+    // the caches print their stats before the bus does
+    std::vector<std::unique_ptr<dcache_sim_t>> hart_dcs;
+    uint64_t insns = 0;
+    auto snapshot = [&]() {
+        if (ic)
+            ic->snapshot(insns);
+        if (dc)
+            dc->snapshot(insns);
+        for (auto &c : hart_dcs)
+            c->snapshot(insns);
+        if (l2)
+            l2->snapshot(insns);
+        if (l3)
+            l3->snapshot(insns);
+    };
+
+    uint64_t addr;
+    size_t bytes;
+    access_type type;
+    if (!bus && !stats_insns) {
+        while (reader.next(addr, bytes, type))
+            tracers.trace(addr, bytes, type);
+        return 0;
+    }
+
+    while (reader.next(addr, bytes, type)) {
+        size_t hart = reader.hart();
+        // made before the hart's first fetch is passed on, so its first
+        // load or store already has a PC
+        while (bus && hart_dcs.size() <= hart) {
+            hart_dcs.emplace_back(new dcache_sim_t(dc_config));
+            hart_dcs.back()->set_bus(&*bus);
+            if (l2)
+                hart_dcs.back()->set_miss_handler(&*l2);
+            hart_dcs.back()->set_log(log_cache);
+        }
+        if (type == FETCH || !bus) {
+            tracers.trace(addr, bytes, type);
+            // tells the hart's D$ the PC of the loads and stores that follow
+            if (type == FETCH && bus)
+                hart_dcs[hart]->trace(addr, bytes, type);
+            if (type == FETCH && stats_insns && ++insns % stats_insns == 0)
+                snapshot();
+            continue;
+        }
+
+        hart_dcs[hart]->trace(addr, bytes, type);
+        if (dcs)
+            dcs->trace(addr, bytes, type);
+    }
+    if (stats_insns && insns % stats_insns)
+        snapshot();
+    hart_dcs.clear();
+    return 0;
+}
@@ -1,39 +1,259 @@
 // See LICENSE for license details.
 
 #include "cachesim.h"
+#include "cachecoh.h"
+#include "cachestats.h"
 #include "common.h"
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <iomanip>
 #include <iostream>
 
 cache_sim_t::cache_sim_t(size_t _sets, size_t _ways, size_t _linesz, const char *_name)
-    : sets(_sets), ways(_ways), linesz(_linesz), name(_name), log(false) {
+    : sets(_sets), ways(_ways), linesz(_linesz), pf(NULL), pf_delay(0), analyzer(NULL), sampler(NULL),
+      timing(NULL), attribution(NULL), pc(0), stats_interval(0), stats_next(UINT64_MAX), stats_records(0),
+      stats_insns(0), stats_last(), bus(NULL), hart(0), name(_name), log(false), quiet(false) {
     init();
 }
 
 static void help() {
     std::cerr << "Cache configurations must be of the form" << std::endl;
-    std::cerr << "  sets:ways:blocksize" << std::endl;
+    std::cerr << "  sets:ways:blocksize[:policy][:key=value...]" << std::endl;
     std::cerr << "where sets, ways, and blocksize are positive integers, with" << std::endl;
     std::cerr << "sets and blocksize both powers of two and blocksize at least 8." << std::endl;
+    std::cerr << "policy is one of lru (default), lru_ts, random, fifo, plru," << std::endl;
+    std::cerr << "srrip, brrip or lfu; plru needs a power-of-two number of ways." << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  incl=nine|inclusive|exclusive  relation to the caches above (default nine);" << std::endl;
+    std::cerr << "                                 exclusive needs their block size and" << std::endl;
+    std::cerr << "                                 inclusive at least their block size" << std::endl;
+    std::cerr << "  write=back|through             write policy (default back)" << std::endl;
+    std::cerr << "  write_alloc=0|1                allocate lines on store misses (default 1)" << std::endl;
+    std::cerr << "  wcb=<n>                        write-combining buffer entries for the stores" << std::endl;
+    std::cerr << "                                 sent on by write=through or write_alloc=0" << std::endl;
+    std::cerr << "  vc=<n>                         victim cache lines (default 0: none)" << std::endl;
+    std::cerr << "  sector=<n>                     sector size of sectored lines (default: whole" << std::endl;
+    std::cerr << "                                 lines); not with pf, lat, analyze or vc" << std::endl;
+    std::cerr << "  pf=next|stride|stream          prefetcher (default none); not in front of" << std::endl;
+    std::cerr << "                                 an exclusive cache" << std::endl;
+    std::cerr << "  pf_degree=<n>                  lines fetched ahead (default 1, stream 4)" << std::endl;
+    std::cerr << "  pf_table=<n>                   stride table entries (default 64)" << std::endl;
+    std::cerr << "  pf_streams=<n>                 stream buffers (default 4)" << std::endl;
+    std::cerr << "  pf_delay=<n>                   accesses before a prefetch arrives (default 0)" << std::endl;
+    std::cerr << "  analyze=0|1                    classify misses as compulsory, capacity or" << std::endl;
+    std::cerr << "                                 conflict and print reuse and per-set histograms" << std::endl;
+    std::cerr << "  attr=<n>                       print the n PCs and address ranges with the" << std::endl;
+    std::cerr << "                                 most misses (default 0: none)" << std::endl;
+    std::cerr << "  attr_range=<n>                 bytes per address range (default 4096)" << std::endl;
+    std::cerr << "  sample=<n>                     simulate one in n sets and estimate the rest;" << std::endl;
+    std::cerr << "                                 not with a next level, pf or analyze" << std::endl;
+    std::cerr << "  lat=<n>                        hit latency in cycles; turns on timing, which" << std::endl;
+    std::cerr << "                                 the levels below need too (default 0: off)" << std::endl;
+    std::cerr << "  mshrs=<n>                      misses in flight (default 4)" << std::endl;
+    std::cerr << "  wbuf=<n>                       write buffer entries (default 4)" << std::endl;
+    std::cerr << "  mem_lat=<n>                    memory latency behind the last level (default 100)" << std::endl;
+    std::cerr << "  mem_bw=<n>                     memory bytes per cycle (default 8)" << std::endl;
+    std::cerr << "  stats=<path>                   write stats records to path, as CSV if it ends" << std::endl;
+    std::cerr << "                                 in .csv and JSON Lines otherwise" << std::endl;
+    std::cerr << "  interval=<n>                   accesses per stats record (default 0: summary only)" << std::endl;
     exit(1);
 }
 
-cache_sim_t *cache_sim_t::construct(const char *config, const char *name) {
-    const char *wp = strchr(config, ':');
-    if (!wp++)
+cache_config_t cache_config_t::parse(const char *config) {
+    std::vector<std::string> fields;
+    for (const char *p = config;; p++) {
+        const char *e = strchr(p, ':');
+        fields.push_back(e ? std::string(p, e) : std::string(p));
+        if (!e)
+            break;
+        p = e;
+    }
+    if (fields.size() < 3)
         help();
-    const char *bp = strchr(wp, ':');
-    if (!bp++)
+
+    cache_config_t c;
+    c.sets = atoi(fields[0].c_str());
+    c.ways = atoi(fields[1].c_str());
+    c.linesz = atoi(fields[2].c_str());
+    c.policy = "lru";
+    c.incl = NINE;
+    c.write_through = false;
+    c.write_allocate = true;
+    c.wcb = 0;
+    c.vc = 0;
+    c.sector = 0;
+    c.pf_degree = 0;
+    c.pf_table = 64;
+    c.pf_streams = 4;
+    c.pf_delay = 0;
+    c.analyze = false;
+    c.sample = 1;
+    c.attr = 0;
+    c.attr_range = 4096;
+    c.latency = 0;
+    c.mshrs = 4;
+    c.wbuf = 4;
+    c.mem_latency = 100;
+    c.mem_bw = 8;
+    c.interval = 0;
+
+    // the policy is the one field after the geometry without a '='
+    for (size_t i = 3; i < fields.size(); i++) {
+        size_t eq = fields[i].find('=');
+        if (eq == std::string::npos) {
+            c.policy = fields[i];
+            continue;
+        }
+
+        std::string key = fields[i].substr(0, eq);
+        std::string value = fields[i].substr(eq + 1);
+        if (key == "incl" && value == "nine")
+            c.incl = NINE;
+        else if (key == "incl" && value == "inclusive")
+            c.incl = INCLUSIVE;
+        else if (key == "incl" && value == "exclusive")
+            c.incl = EXCLUSIVE;
+        else if (key == "write" && (value == "back" || value == "through"))
+            c.write_through = value == "through";
+        else if (key == "write_alloc" && (value == "0" || value == "1"))
+            c.write_allocate = value == "1";
+        else if (key == "wcb")
+            c.wcb = atoi(value.c_str());
+        // vc=0, the default, means no victim cache
+        else if (key == "vc" && atoi(value.c_str()) >= 0)
+            c.vc = atoi(value.c_str());
+        else if (key == "sector")
+            c.sector = atoi(value.c_str());
+        else if (key == "pf")
+            c.pf = value;
+        else if (key == "pf_degree" && atoi(value.c_str()) > 0)
+            c.pf_degree = atoi(value.c_str());
+        else if (key == "pf_table" && atoi(value.c_str()) > 0)
+            c.pf_table = atoi(value.c_str());
+        else if (key == "pf_streams" && atoi(value.c_str()) > 0)
+            c.pf_streams = atoi(value.c_str());
+        else if (key == "pf_delay" && atoi(value.c_str()) >= 0)
+            c.pf_delay = atoi(value.c_str());
+        else if (key == "analyze" && (value == "0" || value == "1"))
+            c.analyze = value == "1";
+        else if (key == "sample" && atoi(value.c_str()) > 0)
+            c.sample = atoi(value.c_str());
+        else if (key == "attr" && atoi(value.c_str()) > 0)
+            c.attr = atoi(value.c_str());
+        else if (key == "attr_range" && atoi(value.c_str()) > 0)
+            c.attr_range = atoi(value.c_str());
+        else if (key == "lat" && atoi(value.c_str()) >= 0)
+            c.latency = atoi(value.c_str());
+        else if (key == "mshrs" && atoi(value.c_str()) > 0)
+            c.mshrs = atoi(value.c_str());
+        else if (key == "wbuf" && atoi(value.c_str()) >= 0)
+            c.wbuf = atoi(value.c_str());
+        else if (key == "mem_lat" && atoi(value.c_str()) >= 0)
+            c.mem_latency = atoi(value.c_str());
+        else if (key == "mem_bw" && atoi(value.c_str()) > 0)
+            c.mem_bw = atoi(value.c_str());
+        else if (key == "stats" && !value.empty())
+            c.stats = value;
+        else if (key == "interval")
+            c.interval = strtoull(value.c_str(), NULL, 10);
+        else
+            help();
+    }
+    return c;
+}
+
+std::string cache_config_t::str() const {
+    return std::to_string(sets) + ":" + std::to_string(ways) + ":" + std::to_string(linesz);
+}
+
+template <class repl_t>
+static cache_sim_t *construct_with(const cache_config_t &c, const char *name) {
+    if (c.ways > 4 /* empirical */ && c.sets == 1)
+        return new fa_cache_sim_t<repl_t>(c.ways, c.linesz, name);
+    return new sa_cache_sim_t<repl_t>(c.sets, c.ways, c.linesz, name);
+}
+
+cache_sim_t *cache_sim_t::construct(const char *config, const char *name) {
+    cache_config_t c = cache_config_t::parse(config);
+    cache_sim_t *cache = NULL;
+
+    if (c.policy == "lru")
+        cache = construct_with<lru_repl_t>(c, name);
+    else if (c.policy == "lru_ts")
+        cache = construct_with<lru_ts_repl_t>(c, name);
+    else if (c.policy == "random")
+        cache = construct_with<random_repl_t>(c, name);
+    else if (c.policy == "fifo")
+        cache = construct_with<fifo_repl_t>(c, name);
+    else if (c.policy == "plru" && !(c.ways & (c.ways - 1)))
+        cache = construct_with<plru_repl_t>(c, name);
+    else if (c.policy == "srrip")
+        cache = construct_with<srrip_repl_t>(c, name);
+    else if (c.policy == "brrip")
+        cache = construct_with<brrip_repl_t>(c, name);
+    else if (c.policy == "lfu")
+        cache = construct_with<lfu_repl_t>(c, name);
+    else
         help();
 
-    size_t sets = atoi(std::string(config, wp).c_str());
-    size_t ways = atoi(std::string(wp, bp).c_str());
-    size_t linesz = atoi(bp);
+    cache->incl = c.incl;
+    // only stores that are sent on can be combined, and their traffic is
+    // not timed
+    if (c.wcb && !c.write_through && c.write_allocate)
+        help();
+    if ((c.write_through || !c.write_allocate) && c.latency)
+        help();
+    cache->write_through = c.write_through;
+    cache->write_allocate = c.write_allocate;
+    cache->wcb_init(c.wcb);
 
-    if (ways > 4 /* empirical */ && sets == 1)
-        return new fa_cache_sim_t(ways, linesz, name);
-    return new cache_sim_t(sets, ways, linesz, name);
+    // an exclusive cache hands lines up without looking in its victim
+    // cache, and sectors are not prefetched, timed or analyzed
+    if (c.vc && (c.incl == cache_config_t::EXCLUSIVE || c.sector))
+        help();
+    if (c.sector && (!c.pf.empty() || c.latency || c.analyze || c.incl == cache_config_t::EXCLUSIVE))
+        help();
+    if (c.sector && (c.sector & (c.sector - 1) || c.sector > c.linesz || c.linesz / c.sector > 64))
+        help();
+    cache->vc_entries = c.vc;
+    cache->vc = fifo_t<uint64_t>(c.vc);
+    if (c.sector && c.sector < c.linesz) {
+        cache->sectorsz = c.sector;
+        cache->sector_valid = new uint64_t[c.sets * c.ways]();
+        cache->sector_dirty = new uint64_t[c.sets * c.ways]();
+    }
+    if (!c.pf.empty()) {
+        prefetcher_t *pf = prefetcher_t::construct(c.pf, c.linesz, c.pf_degree, c.pf_table, c.pf_streams);
+        if (!pf)
+            help();
+        cache->set_prefetcher(pf, c.pf_delay);
+    }
+    if (c.analyze)
+        cache->analyzer = new miss_analyzer_t(c.sets, c.ways, c.linesz);
+    if (c.sample > 1) {
+        if (c.analyze || !c.pf.empty())
+            help();
+        cache->sampler = new set_sampler_t(c.sets, c.sample);
+    }
+    if (c.attr) {
+        // the sampled-out sets' misses are not seen
+        if (c.sample > 1 || (c.attr_range & (c.attr_range - 1)))
+            help();
+        cache->attribution = new miss_attribution_t(c.attr, c.attr_range);
+    }
+    if (c.latency) {
+        // prefetches and sampled-out accesses are not timed
+        if (!c.pf.empty() || c.sample > 1)
+            help();
+        cache->timing = new cache_timing_t(c);
+    }
+    if (!c.stats.empty()) {
+        cache->stats_out = cache_stats_writer_t::open(c.stats);
+        cache->stats_interval = c.interval;
+        cache->stats_next = c.interval ? c.interval : UINT64_MAX;
+    }
+    return cache;
 }
 
 void cache_sim_t::init() {
@@ -41,52 +261,254 @@ void cache_sim_t::init() {
         help();
     if (linesz < 8 || (linesz & (linesz - 1)))
         help();
+    if (ways == 0 || ways > UINT32_MAX)
+        help();
 
     idx_shift = 0;
     for (size_t x = linesz; x > 1; x >>= 1)
         idx_shift++;
 
-    tags = new uint64_t[sets * ways]();
-    read_accesses = 0;
-    read_misses = 0;
-    bytes_read = 0;
-    write_accesses = 0;
-    write_misses = 0;
-    bytes_written = 0;
+    tags = new uint64_t[sets * ways];
+    dirty = new uint8_t[sets * ways]();
+    prefetched = new uint8_t[sets * ways]();
+    shared = new uint8_t[sets * ways]();
+    std::fill(tags, tags + sets * ways, NO_TAG);
+    for (int store = 0; store < 2; store++) {
+        accesses[store] = 0;
+        misses[store] = 0;
+        bytes_accessed[store] = 0;
+    }
     writebacks = 0;
-
-    // initialize time_stamp which stores the time stamp of each cache line
-    time_stamp = new uint64_t[sets * ways]();
-    for (uint64_t i = 0; i < sets * ways; i++)
-        time_stamp[i] = 0;
-
-    // stores the current time (most recelty called cache has higher curr_time)
-    curr_time = 0;
+    fill_bytes = 0;
+    writeback_bytes = 0;
+    back_invalidations = 0;
+    victim_fills = 0;
+    write_through = false;
+    write_allocate = true;
+    wcb_entries = 0;
+    write_through_bytes = 0;
+    write_around_bytes = 0;
+    wcb_merges = 0;
+    wcb_flushes = 0;
+    wcb_bytes = 0;
+    vc_entries = 0;
+    vc_hits = 0;
+    sectorsz = 0;
+    sector_valid = NULL;
+    sector_dirty = NULL;
+    victim_valid_sectors = 0;
+    victim_dirty_sectors = 0;
+    sector_misses = 0;
+    upgrades = 0;
+    coherence_invalidations = 0;
+    interventions = 0;
+    coherence_misses = 0;
+    false_sharing_misses = 0;
 
     miss_handler = NULL;
+    incl = cache_config_t::NINE;
 }
 
 cache_sim_t::cache_sim_t(const cache_sim_t &rhs)
-    : sets(rhs.sets), ways(rhs.ways), linesz(rhs.linesz),
-      idx_shift(rhs.idx_shift), name(rhs.name), log(false) {
+    : miss_handler(NULL), incl(rhs.incl), sets(rhs.sets), ways(rhs.ways), linesz(rhs.linesz),
+      idx_shift(rhs.idx_shift), accesses(), misses(), bytes_accessed(), writebacks(0),
+      fill_bytes(0), writeback_bytes(0), back_invalidations(0), victim_fills(0), write_through(rhs.write_through),
+      write_allocate(rhs.write_allocate), wcb_entries(rhs.wcb_entries), write_through_bytes(0),
+      write_around_bytes(0), wcb_merges(0), wcb_flushes(0), wcb_bytes(0), vc_entries(rhs.vc_entries), vc(rhs.vc),
+      vc_hits(0), sectorsz(rhs.sectorsz), sector_valid(NULL), sector_dirty(NULL), victim_valid_sectors(0),
+      victim_dirty_sectors(0), sector_misses(0), pf(NULL), pf_delay(0), analyzer(NULL), sampler(NULL), timing(NULL),
+      attribution(NULL), pc(0), stats_interval(0), stats_next(UINT64_MAX), stats_records(0), stats_insns(0), stats_last(), bus(NULL),
+      hart(0), upgrades(0), coherence_invalidations(0), interventions(0), coherence_misses(0),
+      false_sharing_misses(0), name(rhs.name), log(false), quiet(false) {
     tags = new uint64_t[sets * ways];
+    dirty = new uint8_t[sets * ways];
+    prefetched = new uint8_t[sets * ways];
+    shared = new uint8_t[sets * ways];
     memcpy(tags, rhs.tags, sets * ways * sizeof(uint64_t));
+    memcpy(dirty, rhs.dirty, sets * ways);
+    memcpy(prefetched, rhs.prefetched, sets * ways);
+    memcpy(shared, rhs.shared, sets * ways);
+    if (rhs.sector_valid) {
+        sector_valid = new uint64_t[sets * ways];
+        sector_dirty = new uint64_t[sets * ways];
+        memcpy(sector_valid, rhs.sector_valid, sets * ways * sizeof(uint64_t));
+        memcpy(sector_dirty, rhs.sector_dirty, sets * ways * sizeof(uint64_t));
+    }
+    wcb_init(wcb_entries);
+}
+
+void cache_sim_t::set_miss_handler(cache_sim_t *mh) {
+    // an exclusive cache swaps whole lines with the caches above it, and an
+    // inclusive one must be able to hold a whole line of theirs
+    if (mh && mh->incl == cache_config_t::EXCLUSIVE && mh->linesz != linesz)
+        help();
+    if (mh && mh->incl == cache_config_t::INCLUSIVE && mh->linesz < linesz)
+        help();
+    // prefetched lines are fetched without evicting anything into mh, and
+    // mh would only see the misses of the sampled sets
+    if (mh && mh->incl == cache_config_t::EXCLUSIVE && pf)
+        help();
+    if (mh && sampler)
+        help();
+    // and single stores or sectors cannot go into an exclusive cache
+    if (mh && mh->incl == cache_config_t::EXCLUSIVE && (write_through || !write_allocate || sector_valid))
+        help();
+    // a timed cache needs to know when mh answers, and a timed mh when its
+    // requests arrive
+    if (mh && !timing != !mh->timing)
+        help();
 
-    // copy time_stamp
-    time_stamp = new uint64_t[sets * ways];
-    memcpy(time_stamp, rhs.time_stamp, sets * ways * sizeof(uint64_t));
+    miss_handler = mh;
+    if (mh)
+        mh->uppers.push_back(this);
+}
+
+void cache_sim_t::set_prefetcher(prefetcher_t *_pf, size_t delay) {
+    if (_pf && ((miss_handler && miss_handler->incl == cache_config_t::EXCLUSIVE) || bus))
+        help();
 
-    // copy curr_time
-    curr_time = rhs.curr_time;
+    delete pf;
+    pf = _pf;
+    pf_delay = delay;
+    // a prefetch is in flight for delay accesses, and each access asks for
+    // up to degree lines
+    pf_inflight = fifo_t<inflight_t>(pf && delay ? pf->degree * (delay + 1) : 0);
 }
 
 cache_sim_t::~cache_sim_t() {
-    print_stats();
+    if (stats_out && accesses[0] + accesses[1]) {
+        // the rest of the last interval, if there is a series to end
+        if (stats_records && accesses[0] + accesses[1] > stats_last.read_accesses + stats_last.write_accesses)
+            snapshot(stats_insns);
+        stats_out->write(name, -1, stats_insns, accesses[0] + accesses[1], stats());
+    }
+    if (!quiet)
+        print_stats();
+    delete attribution;
+    delete timing;
+    delete sampler;
+    delete analyzer;
+    delete pf;
+    delete[] sector_dirty;
+    delete[] sector_valid;
+    delete[] shared;
+    delete[] prefetched;
+    delete[] dirty;
     delete[] tags;
-    delete[] time_stamp;
+}
+
+void cache_sim_t::count_insn() {
+    stats_insns++;
+    // the levels below see the instructions of every cache above them, so
+    // they keep the largest count
+    for (cache_sim_t *c = miss_handler; c; c = c->miss_handler)
+        c->stats_insns = std::max(c->stats_insns, stats_insns);
+}
+
+// Writes a record with the counts since the last one
+void cache_sim_t::snapshot(uint64_t insns) {
+    if (!stats_out)
+        return;
+
+    cache_stats_t now = stats();
+    cache_stats_t s = now;
+    s.read_accesses -= stats_last.read_accesses;
+    s.read_misses -= stats_last.read_misses;
+    s.write_accesses -= stats_last.write_accesses;
+    s.write_misses -= stats_last.write_misses;
+    s.writebacks -= stats_last.writebacks;
+    s.latency_cycles -= stats_last.latency_cycles;
+    stats_out->write(name, stats_records++, insns, accesses[0] + accesses[1], s);
+
+    stats_last = now;
+    stats_insns = insns;
 }
 
 void cache_sim_t::print_stats() {
+    stats().print(name);
+    if (analyzer && accesses[0] + accesses[1])
+        analyzer->print(name);
+    if (attribution)
+        attribution->print(name);
+}
+
+bool cache_sim_t::wants_pc() const {
+    for (const cache_sim_t *c = this; c; c = c->miss_handler) {
+        if (c->attribution || (c->pf && c->pf->wants_pc()) || c->stats_interval)
+            return true;
+    }
+    return false;
+}
+
+cache_stats_t cache_sim_t::stats() const {
+    cache_stats_t s = cache_stats_t();
+    s.read_accesses = accesses[0];
+    s.read_misses = misses[0];
+    s.bytes_read = bytes_accessed[0];
+    s.write_accesses = accesses[1];
+    s.write_misses = misses[1];
+    s.bytes_written = bytes_accessed[1];
+    s.writebacks = writebacks;
+    s.fill_bytes = fill_bytes;
+    s.writeback_bytes = writeback_bytes;
+    s.back_invalidations = back_invalidations;
+    s.victim_fills = victim_fills;
+    s.write_through_bytes = write_through_bytes;
+    s.write_around_bytes = write_around_bytes;
+    s.wcb_merges = wcb_merges;
+    s.wcb_flushes = wcb_flushes;
+    s.wcb_bytes = wcb_bytes;
+    s.vc_hits = vc_hits;
+    s.sector_misses = sector_misses;
+    s.upgrades = upgrades;
+    s.coherence_invalidations = coherence_invalidations;
+    s.interventions = interventions;
+    s.coherence_misses = coherence_misses;
+    s.false_sharing_misses = false_sharing_misses;
+    if (pf) {
+        s.pf_issued = pf->issued;
+        s.pf_useful = pf->useful;
+        s.pf_late = pf->late;
+        s.pf_useless = pf->useless;
+        // still resident, buffered or on the way when the simulation ended
+        s.pf_unused = pf->buffered() + pf_inflight.size();
+        for (size_t i = 0; i < sets * ways; i++)
+            s.pf_unused += prefetched[i];
+    }
+    if (analyzer) {
+        s.compulsory_misses = analyzer->compulsory;
+        s.capacity_misses = analyzer->capacity;
+        s.conflict_misses = analyzer->conflict;
+    }
+    if (sampler) {
+        // scale the sampled sets' events up to all accesses
+        uint64_t sampled = sampler->read_accesses + sampler->write_accesses;
+        if (sampler->read_accesses)
+            s.read_misses = double(misses[0]) * accesses[0] / sampler->read_accesses + 0.5;
+        if (sampler->write_accesses)
+            s.write_misses = double(misses[1]) * accesses[1] / sampler->write_accesses + 0.5;
+        if (sampled) {
+            double scale = double(accesses[0] + accesses[1]) / sampled;
+            s.writebacks = writebacks * scale + 0.5;
+            s.fill_bytes = fill_bytes * scale + 0.5;
+            s.writeback_bytes = writeback_bytes * scale + 0.5;
+        }
+        s.sampled_sets = sampler->nsampled;
+        s.total_sets = sets;
+        s.miss_rate_ci = sampler->miss_rate_ci();
+    }
+    if (timing) {
+        s.latency_cycles = timing->latency_cycles;
+        s.stall_cycles = timing->stall_cycles;
+        s.core_cycles = timing->clock;
+        s.mshr_merges = timing->merges;
+        s.mshr_stall_cycles = timing->mshr_stall_cycles;
+        s.wbuf_stall_cycles = timing->wbuf_stall_cycles;
+    }
+    return s;
+}
+
+void cache_stats_t::print(const std::string &name) const {
     if (read_accesses + write_accesses == 0)
         return;
 
@@ -107,133 +529,1071 @@ void cache_sim_t::print_stats() {
     std::cout << "Write Misses:          " << write_misses << std::endl;
     std::cout << name << " ";
     std::cout << "Writebacks:            " << writebacks << std::endl;
+    if (back_invalidations) {
+        std::cout << name << " ";
+        std::cout << "Back Invalidations:    " << back_invalidations << std::endl;
+    }
+    if (victim_fills) {
+        std::cout << name << " ";
+        std::cout << "Victim Fills:          " << victim_fills << std::endl;
+    }
+    if (vc_hits) {
+        std::cout << name << " ";
+        std::cout << "Victim Cache Hits:     " << vc_hits << std::endl;
+    }
+    if (sector_misses) {
+        std::cout << name << " ";
+        std::cout << "Sector Misses:         " << sector_misses << std::endl;
+    }
+    if (write_through_bytes + write_around_bytes) {
+        std::cout << name << " ";
+        std::cout << "Write-Through Bytes:   " << write_through_bytes << std::endl;
+        std::cout << name << " ";
+        std::cout << "Write-Around Bytes:    " << write_around_bytes << std::endl;
+        if (wcb_merges + wcb_flushes) {
+            std::cout << name << " ";
+            std::cout << "WCB Merges:            " << wcb_merges << std::endl;
+            std::cout << name << " ";
+            std::cout << "WCB Flushes:           " << wcb_flushes << std::endl;
+            std::cout << name << " ";
+            std::cout << "WCB Bytes:             " << wcb_bytes << std::endl;
+        }
+    }
+    if (upgrades + coherence_invalidations + interventions + coherence_misses) {
+        std::cout << name << " ";
+        std::cout << "Upgrades:              " << upgrades << std::endl;
+        std::cout << name << " ";
+        std::cout << "Invalidations:         " << coherence_invalidations << std::endl;
+        std::cout << name << " ";
+        std::cout << "Interventions:         " << interventions << std::endl;
+        std::cout << name << " ";
+        std::cout << "Coherence Misses:      " << coherence_misses << std::endl;
+        std::cout << name << " ";
+        std::cout << "False Sharing Misses:  " << false_sharing_misses << std::endl;
+    }
+    if (compulsory_misses + capacity_misses + conflict_misses) {
+        std::cout << name << " ";
+        std::cout << "Compulsory Misses:     " << compulsory_misses << std::endl;
+        std::cout << name << " ";
+        std::cout << "Capacity Misses:       " << capacity_misses << std::endl;
+        std::cout << name << " ";
+        std::cout << "Conflict Misses:       " << conflict_misses << std::endl;
+    }
+    if (sampled_sets) {
+        std::cout << name << " ";
+        std::cout << "Sampled Sets:          " << sampled_sets << "/" << total_sets << std::endl;
+        std::cout << name << " ";
+        std::cout << "95% Confidence:        +/-" << miss_rate_ci << '%' << std::endl;
+    }
+    if (latency_cycles) {
+        std::cout << name << " ";
+        std::cout << "AMAT:                  " << double(latency_cycles) / (read_accesses + write_accesses)
+                  << " cycles" << std::endl;
+        if (stall_cycles) {
+            std::cout << name << " ";
+            std::cout << "Stall Cycles:          " << stall_cycles << std::endl;
+        }
+        std::cout << name << " ";
+        std::cout << "MSHR Merges:           " << mshr_merges << std::endl;
+        std::cout << name << " ";
+        std::cout << "MSHR Full Cycles:      " << mshr_stall_cycles << std::endl;
+        std::cout << name << " ";
+        std::cout << "Write Buffer Full:     " << wbuf_stall_cycles << std::endl;
+        if (core_cycles) {
+            std::cout << name << " ";
+            std::cout << "Core Cycles:           " << core_cycles << std::endl;
+        }
+    }
+    if (pf_issued) {
+        std::cout << name << " ";
+        std::cout << "Prefetches Issued:     " << pf_issued << std::endl;
+        std::cout << name << " ";
+        std::cout << "Prefetches Useful:     " << pf_useful << std::endl;
+        std::cout << name << " ";
+        std::cout << "Prefetches Late:       " << pf_late << std::endl;
+        std::cout << name << " ";
+        std::cout << "Prefetches Useless:    " << pf_useless << std::endl;
+        std::cout << name << " ";
+        std::cout << "Prefetches Unused:     " << pf_unused << std::endl;
+        // useful prefetches are misses that did not happen
+        std::cout << name << " ";
+        std::cout << "Prefetch Accuracy:     " << 100.0f * pf_useful / pf_issued << '%' << std::endl;
+        std::cout << name << " ";
+        std::cout << "Prefetch Coverage:     "
+                  << 100.0f * pf_useful / (pf_useful + read_misses + write_misses) << '%' << std::endl;
+    }
     std::cout << name << " ";
     std::cout << "Miss Rate:             " << mr << '%' << std::endl;
 }
 
-uint64_t *cache_sim_t::check_tag(uint64_t addr) {
-    size_t idx = (addr >> idx_shift) & (sets - 1);
-    size_t tag = (addr >> idx_shift) | VALID;
+template <class cache_t>
+void cache_sim_t::access_as(uint64_t addr, size_t bytes, bool store) {
+    cache_t *self = static_cast<cache_t *>(this);
+    if (unlikely(accesses[0] + accesses[1] >= stats_next)) {
+        snapshot(stats_insns);
+        stats_next += stats_interval;
+    }
+    accesses[store]++;
+    bytes_accessed[store] += bytes;
+
+    size_t set = (addr >> idx_shift) & (sets - 1);
+    if (unlikely(sampler != NULL)) {
+        if (!sampler->sampled(set))
+            return;
+        sampler->access(set, store);
+    }
+    uint64_t t = unlikely(timing != NULL) ? timing_start() : 0;
+
+    if (unlikely(!pf_inflight.empty()))
+        prefetch_arrive();
 
-    for (size_t i = 0; i < ways; i++)
-        if (tag == (tags[idx * ways + i] & ~DIRTY)) {
-            // update time stamp if there is a hit
-            time_stamp[idx * ways + i] = curr_time++;
-            return &tags[idx * ways + i];
+    size_t hit_line = self->cache_t::check_tag(addr);
+    if (likely(hit_line != NO_LINE)) {
+        if (unlikely(sector_valid != NULL) && (sector_mask(addr, bytes) & ~sector_valid[hit_line])) {
+            sector_miss(hit_line, addr, bytes, store, set);
+            return;
+        }
+        if (unlikely(write_through) && store) {
+            write_through_bytes += bytes;
+            write_next(addr, bytes);
+        } else {
+            dirty[hit_line] |= store;
+            if (unlikely(sector_dirty != NULL) && store)
+                sector_dirty[hit_line] |= sector_mask(addr, bytes);
         }
+        if (unlikely(bus != NULL) && store)
+            bus->write_hit(this, hit_line, addr, bytes);
+        if (unlikely(pf != NULL))
+            prefetch_hit(addr, hit_line);
+        if (unlikely(analyzer != NULL))
+            analyzer->access(addr, false);
+        if (unlikely(timing != NULL))
+            timing_hit(addr, t, store);
+        return;
+    }
 
-    return NULL;
-}
+    bool around = unlikely(!write_allocate) && store;
+    bool taken = unlikely(pf != NULL) && !around && prefetch_take(addr, store && !write_through);
+    if (unlikely(analyzer != NULL))
+        analyzer->access(addr, !taken);
+    if (taken) {
+        if (unlikely(write_through) && store) {
+            write_through_bytes += bytes;
+            write_next(addr, bytes);
+        }
+        return;
+    }
 
-uint64_t cache_sim_t::victimize(uint64_t addr) {
-    size_t idx = (addr >> idx_shift) & (sets - 1);
+    misses[store]++;
+    if (unlikely(sampler != NULL))
+        sampler->miss(set);
+    if (unlikely(attribution != NULL))
+        attribution->miss(pc, addr);
+    if (miss_handler)
+        miss_handler->pc = pc;
+    if (log) {
+        std::cerr << name << " "
+                  << (store ? "write" : "read") << " miss 0x"
+                  << std::hex << addr << std::endl;
+    }
+
+    // a store miss without write-allocate goes around the cache, and a load
+    // miss must not overtake the stores to its line that are still buffered
+    if (around) {
+        write_around_bytes += bytes;
+        write_next(addr, bytes);
+        return;
+    }
+    if (unlikely(!wcb.empty()))
+        wcb_flush(addr);
+
+    if (unlikely(timing != NULL))
+        timing_miss(t);
 
-    uint64_t lru_time = time_stamp[idx * ways];
-    uint64_t lru_index = idx * ways;
+    // a line still in the victim cache comes back from there
+    uint64_t from_vc = unlikely(vc_entries != 0) ? vc_take(addr) : 0;
+    if (from_vc)
+        vc_hits++;
 
-    // loop to find the least recently used cache line
-    for (uint64_t i = 0; i < ways; i++) {
-        if (time_stamp[idx * ways + i] < lru_time) {
-            lru_time = time_stamp[idx * ways + i];
-            lru_index = idx * ways + i;
+    uint64_t victim;
+    size_t line = self->cache_t::victimize(addr, victim);
+    if (victim & VALID)
+        evict(victim);
+
+    // a miss on a line that is still being prefetched waits for it instead
+    // of fetching it a second time, and one that another hart's cache
+    // supplies skips the next level
+    bool supplied = false, fill_shared = false;
+    if (unlikely(bus != NULL))
+        supplied = bus->miss(this, addr, bytes, store, fill_shared);
+
+    uint64_t fill_dirty = 0;
+    if (unlikely(pf != NULL) && prefetch_cancel(addr))
+        pf->late++;
+    else if (from_vc)
+        fill_dirty = from_vc & DIRTY;
+    else if (unlikely(sector_valid != NULL))
+        sector_transfer(addr & ~(linesz - 1), sector_mask(addr, bytes), false);
+    else if (!supplied) {
+        fill_bytes += linesz;
+        if (miss_handler) {
+            if (unlikely(timing != NULL))
+                miss_handler->timing->arrival = timing->request;
+            fill_dirty = miss_handler->fetch(addr & ~(linesz - 1));
         }
     }
 
-    // update time stamp of the least recently used cache line
-    time_stamp[lru_index] = curr_time++;
+    // fill_line left the line clean and unshared
+    if (likely(holds(line, addr))) {
+        dirty[line] = (store & !write_through) | (fill_dirty != 0);
+        shared[line] = fill_shared;
+        if (unlikely(sector_valid != NULL)) {
+            sector_valid[line] = sector_mask(addr, bytes);
+            sector_dirty[line] = dirty[line] ? sector_valid[line] : 0;
+        }
+    }
 
-    uint64_t victim = tags[lru_index];
-    tags[lru_index] = (addr >> idx_shift) | VALID;
+    if (unlikely(timing != NULL))
+        timing_fill(addr, t, store, supplied || from_vc);
 
-    // original code
-    // size_t way = lfsr.next() % ways;
-    // uint64_t victim = tags[idx * ways + way];
-    // tags[idx * ways + way] = (addr >> idx_shift) | VALID;
-    return victim;
-}
+    if (unlikely(write_through) && store) {
+        write_through_bytes += bytes;
+        write_next(addr, bytes);
+    }
 
-void cache_sim_t::access(uint64_t addr, size_t bytes, bool store) {
-    store ? write_accesses++ : read_accesses++;
-    (store ? bytes_written : bytes_read) += bytes;
+    if (unlikely(pf != NULL))
+        prefetch_observe(addr, true, false);
+}
 
-    uint64_t *hit_way = check_tag(addr);
-    if (likely(hit_way != NULL)) {
-        if (store)
-            *hit_way |= DIRTY;
-        return;
+// Removes the line at addr from the victim cache, returning it packed (or 0)
+uint64_t cache_sim_t::vc_take(uint64_t addr) {
+    uint64_t tag = addr >> idx_shift;
+    for (size_t i = 0; i < vc.size(); i++) {
+        if ((vc[i] & ~(VALID | STATUS)) == tag) {
+            uint64_t line = vc[i];
+            vc.erase(i);
+            return line;
+        }
     }
+    return 0;
+}
+
+// The sectors of a line that [addr, addr + bytes) touches
+uint64_t cache_sim_t::sector_mask(uint64_t addr, size_t bytes) const {
+    size_t first = (addr & (linesz - 1)) / sectorsz;
+    size_t last = (std::min<size_t>((addr & (linesz - 1)) + std::max<size_t>(bytes, 1), linesz) - 1) / sectorsz;
+    return (last == 63 ? ~0ULL : (2ULL << last) - 1) & ~((1ULL << first) - 1);
+}
 
-    store ? write_misses++ : read_misses++;
+// An access to a present line that needs sectors it does not have
+void cache_sim_t::sector_miss(size_t line, uint64_t addr, size_t bytes, bool store, size_t set) {
+    uint64_t mask = sector_mask(addr, bytes);
+    misses[store]++;
+    sector_misses++;
+    if (unlikely(sampler != NULL))
+        sampler->miss(set);
+    if (unlikely(attribution != NULL))
+        attribution->miss(pc, addr);
+    if (miss_handler)
+        miss_handler->pc = pc;
     if (log) {
         std::cerr << name << " "
-                  << (store ? "write" : "read") << " miss 0x"
+                  << (store ? "write" : "read") << " sector miss 0x"
                   << std::hex << addr << std::endl;
     }
 
-    uint64_t victim = victimize(addr);
+    if (store && !write_allocate) {
+        write_around_bytes += bytes;
+        write_next(addr, bytes);
+        return;
+    }
+    if (unlikely(!wcb.empty()))
+        wcb_flush(addr);
+
+    sector_transfer(addr & ~(linesz - 1), mask & ~sector_valid[line], false);
+    sector_valid[line] |= mask;
+    if (store && write_through) {
+        write_through_bytes += bytes;
+        write_next(addr, bytes);
+    } else if (store) {
+        dirty[line] = 1;
+        sector_dirty[line] |= mask;
+    }
+}
+
+// Fetches the given sectors of the line at line_addr from the next level,
+// or writes them back to it, one sector per access
+void cache_sim_t::sector_transfer(uint64_t line_addr, uint64_t sectors, bool store) {
+    (store ? writeback_bytes : fill_bytes) += __builtin_popcountll(sectors) * sectorsz;
+    if (!miss_handler)
+        return;
+    for (size_t i = 0; sectors; i++, sectors >>= 1) {
+        if (sectors & 1)
+            miss_handler->access(line_addr + i * sectorsz, sectorsz, store);
+    }
+}
+
+// Sends a store this cache does not keep dirty on to the next level,
+// combining it with the other stores to its line in the buffer if there is
+// one
+void cache_sim_t::write_next(uint64_t addr, size_t bytes) {
+    if (miss_handler)
+        miss_handler->pc = pc;
+    if (!wcb_entries) {
+        if (miss_handler)
+            miss_handler->access(addr, bytes, true);
+        return;
+    }
+
+    uint64_t line_addr = addr & ~(linesz - 1);
+    size_t begin = addr - line_addr;
+    size_t end = std::min(begin + bytes, linesz);
+    for (size_t i = 0; i < wcb.size(); i++) {
+        if (wcb[i].line == line_addr) {
+            uint8_t *written = &wcb_written[wcb[i].slot * linesz];
+            std::fill(written + begin, written + end, 1);
+            wcb_merges++;
+            return;
+        }
+    }
+
+    if (wcb.size() == wcb_entries)
+        wcb_flush(wcb.front().line);
+    size_t slot = wcb_free.back();
+    wcb_free.pop_back();
+    wcb.push_back(wcb_entry_t{line_addr, slot});
+    uint8_t *written = &wcb_written[slot * linesz];
+    std::fill(written, written + linesz, 0);
+    std::fill(written + begin, written + end, 1);
+}
+
+// Sizes the write-combining buffer for entries lines, all of them free
+void cache_sim_t::wcb_init(size_t entries) {
+    wcb_entries = entries;
+    wcb = fifo_t<wcb_entry_t>(entries);
+    wcb_written.assign(entries * linesz, 0);
+    wcb_free.clear();
+    for (size_t slot = entries; slot > 0; slot--)
+        wcb_free.push_back(slot - 1);
+}
+
+// Writes the buffered stores to the line at addr to the next level
+void cache_sim_t::wcb_flush(uint64_t addr) {
+    uint64_t line_addr = addr & ~(linesz - 1);
+    for (size_t i = 0; i < wcb.size(); i++) {
+        if (wcb[i].line != line_addr)
+            continue;
 
-    if ((victim & (VALID | DIRTY)) == (VALID | DIRTY)) {
-        uint64_t dirty_addr = (victim & ~(VALID | DIRTY)) << idx_shift;
+        uint8_t *written = &wcb_written[wcb[i].slot * linesz];
+        size_t bytes = std::count(written, written + linesz, 1);
+        wcb_flushes++;
+        wcb_bytes += bytes;
         if (miss_handler)
-            miss_handler->access(dirty_addr, linesz, true);
+            miss_handler->access(line_addr, bytes, true);
+        wcb_free.push_back(wcb[i].slot);
+        wcb.erase(i);
+        return;
+    }
+}
+
+// Disposes of a valid line that victimize pushed out
+void cache_sim_t::evict(uint64_t victim) {
+    uint64_t victim_addr = (victim & ~(VALID | STATUS)) << idx_shift;
+
+    if (victim & PREFETCHED)
+        pf->useless++;
+
+    // an inclusive cache takes its victims away from the caches above it,
+    // picking up their dirty data on the way
+    if (incl == cache_config_t::INCLUSIVE) {
+        for (auto upper : uppers)
+            victim |= upper->back_invalidate(victim_addr, linesz);
+    }
+
+    // a victim cache takes the victim in, and the line it pushes out in turn
+    // is the one to dispose of
+    if (unlikely(vc_entries != 0)) {
+        if (vc.size() < vc_entries) {
+            vc.push_back(victim);
+            return;
+        }
+        uint64_t oldest = vc.front();
+        vc.pop_front();
+        vc.push_back(victim);
+        victim = oldest;
+        victim_addr = (victim & ~(VALID | STATUS)) << idx_shift;
+    }
+
+    if (miss_handler && miss_handler->incl == cache_config_t::EXCLUSIVE) {
+        // an exclusive cache below receives every victim, clean or dirty
+        if (unlikely(timing != NULL))
+            miss_handler->timing->arrival = timing->request;
+        miss_handler->insert_victim(victim_addr, victim & DIRTY);
+        if (victim & DIRTY) {
+            writebacks++;
+            writeback_bytes += linesz;
+        }
+    } else if (victim & DIRTY) {
+        if (unlikely(timing != NULL))
+            timing_writeback(victim_addr);
+        else if (unlikely(sector_valid != NULL))
+            // dirty data picked up from the caches above may be in any
+            // sector that was valid
+            sector_transfer(victim_addr, victim_dirty_sectors ? victim_dirty_sectors : victim_valid_sectors, true);
+        else if (miss_handler)
+            miss_handler->access(victim_addr, linesz, true);
+        if (likely(sector_valid == NULL))
+            writeback_bytes += linesz;
         writebacks++;
     }
+}
 
+// Supplies the line at addr to a cache above on its miss. Returns DIRTY if
+// the line comes with dirty data, which only an exclusive cache hands over.
+uint64_t cache_sim_t::fetch(uint64_t addr) {
+    if (incl != cache_config_t::EXCLUSIVE) {
+        access(addr, linesz, false);
+        return 0;
+    }
+
+    accesses[0]++;
+    bytes_accessed[0] += linesz;
+
+    // a hit moves the line up, a miss bypasses this cache entirely
+    uint64_t old = invalidate(addr);
+    if (unlikely(analyzer != NULL))
+        analyzer->access(addr, !(old & VALID));
+    uint64_t t = unlikely(timing != NULL) ? timing_start() : 0;
+    if (old & VALID) {
+        if (unlikely(timing != NULL))
+            timing_finish(t, t + timing->latency, false);
+        return old & DIRTY;
+    }
+
+    misses[0]++;
+    if (unlikely(attribution != NULL))
+        attribution->miss(pc, addr);
     if (miss_handler)
-        miss_handler->access(addr & ~(linesz - 1), linesz, false);
+        miss_handler->pc = pc;
+    if (log)
+        std::cerr << name << " read miss 0x" << std::hex << addr << std::endl;
+
+    if (!miss_handler) {
+        if (unlikely(timing != NULL))
+            timing_finish(t, timing_memory(t + timing->latency), false);
+        return 0;
+    }
+    if (unlikely(timing != NULL))
+        miss_handler->timing->arrival = t + timing->latency;
+    uint64_t fill_dirty = miss_handler->fetch(addr);
+    if (unlikely(timing != NULL))
+        timing_finish(t, miss_handler->timing->done, false);
+    return fill_dirty;
+}
+
+// Places a line evicted from a cache above into this exclusive cache
+void cache_sim_t::insert_victim(uint64_t addr, bool victim_dirty) {
+    victim_fills++;
+
+    // the I$ and D$ may both have held the line
+    size_t line = check_tag(addr);
+    if (line == NO_LINE) {
+        // the victim's own writeback leaves when the victim arrives
+        if (unlikely(timing != NULL))
+            timing->request = timing->arrival;
+        uint64_t victim;
+        line = victimize(addr, victim);
+        if (victim & VALID)
+            evict(victim);
+    }
+    dirty[line] |= victim_dirty;
+}
+
+// Removes the lines covering [addr, addr + bytes) from this cache and every
+// cache above it, returning DIRTY if any removed copy was dirty
+uint64_t cache_sim_t::back_invalidate(uint64_t addr, size_t bytes) {
+    uint64_t dirty = 0;
+    for (uint64_t a = addr & ~(linesz - 1); a < addr + bytes; a += linesz) {
+        for (auto upper : uppers)
+            dirty |= upper->back_invalidate(a, linesz);
+
+        uint64_t old = invalidate(a);
+        if (unlikely(vc_entries != 0) && !(old & VALID))
+            old = vc_take(a);
+        if (old & VALID) {
+            back_invalidations++;
+            dirty |= old & DIRTY;
+        }
+    }
+    return dirty;
+}
+
+// A demand hit; the first one on a prefetched line makes the prefetch useful
+void cache_sim_t::prefetch_hit(uint64_t addr, size_t line) {
+    bool first_use = prefetched[line];
+    if (first_use) {
+        prefetched[line] = 0;
+        pf->useful++;
+    }
+    prefetch_observe(addr, false, first_use);
+}
+
+// Moves the line at addr out of the prefetcher's buffers into this cache on
+// a miss. Returns false if the prefetcher does not hold it.
+bool cache_sim_t::prefetch_take(uint64_t addr, bool store) {
+    pf_lines.clear();
+    if (!pf->take(addr & ~(linesz - 1), pf_lines))
+        return false;
+
+    pf->useful++;
+    uint64_t victim;
+    size_t line = victimize(addr, victim);
+    if (victim & VALID)
+        evict(victim);
+    if (holds(line, addr))
+        dirty[line] = store;
+
+    prefetch_issue();
+    return true;
+}
+
+// Whether the line at line_addr is being prefetched
+bool cache_sim_t::prefetch_inflight(uint64_t line_addr) const {
+    for (size_t i = 0; i < pf_inflight.size(); i++) {
+        if (pf_inflight[i].addr == line_addr)
+            return true;
+    }
+    return false;
+}
+
+// Drops the prefetch of the line at addr if it has not arrived yet
+bool cache_sim_t::prefetch_cancel(uint64_t addr) {
+    uint64_t line_addr = addr & ~(linesz - 1);
+    for (size_t i = 0; i < pf_inflight.size(); i++) {
+        if (pf_inflight[i].addr == line_addr) {
+            pf_inflight.erase(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Fills the prefetches whose delay has passed; every prefetch waits equally
+// long, so they arrive in the order they were issued
+void cache_sim_t::prefetch_arrive() {
+    uint64_t now = accesses[0] + accesses[1];
+    while (!pf_inflight.empty() && pf_inflight.front().ready <= now) {
+        prefetch_fill(pf_inflight.front().addr);
+        pf_inflight.pop_front();
+    }
+}
+
+void cache_sim_t::prefetch_observe(uint64_t addr, bool miss, bool first_use) {
+    pf_lines.clear();
+    pf->observe(pc, addr, miss, first_use, pf_lines);
+    prefetch_issue();
+}
+
+// Fetches the lines the prefetcher asked for from the next level
+void cache_sim_t::prefetch_issue() {
+    bool fill = pf->fills_cache();
+    for (auto line_addr : pf_lines) {
+        if (fill && probe_tag(line_addr) != NO_LINE)
+            continue;
+        if (fill && prefetch_inflight(line_addr))
+            continue;
+
+        pf->issued++;
+        fill_bytes += linesz;
+        if (miss_handler)
+            miss_handler->fetch(line_addr);
+
+        if (fill && pf_delay)
+            pf_inflight.push_back(inflight_t{line_addr, accesses[0] + accesses[1] + pf_delay});
+        else if (fill)
+            prefetch_fill(line_addr);
+    }
+}
+
+void cache_sim_t::prefetch_fill(uint64_t addr) {
+    uint64_t victim;
+    size_t line = victimize(addr, victim);
+    if (victim & VALID)
+        evict(victim);
+    if (holds(line, addr))
+        prefetched[line] = 1;
+}
+
+miss_analyzer_t::miss_analyzer_t(size_t _sets, size_t ways, size_t linesz)
+    : compulsory(0), capacity(0), conflict(0), sets(_sets), last_page_key(UINT64_MAX),
+      last_page(NULL), now(0), next_tick(0), live(0), distance(REUSE_BUCKETS + 1, 0),
+      reuse(REUSE_BUCKETS, 0), beyond(0), set_misses(_sets, 0) {
+    idx_shift = 0;
+    for (size_t x = linesz; x > 1; x >>= 1)
+        idx_shift++;
+
+    shadow_index.init(sets * ways);
+    shadow_repl.init(1, sets * ways);
+    shadow_keys.assign(sets * ways, 0);
+    shadow_time.assign(sets * ways, 0);
+    shadow_tick.assign(sets * ways, 0);
+    tick_tree.assign(2 * sets * ways + 1, 0);
+}
+
+void miss_analyzer_t::tick_add(uint64_t tick, int32_t n) {
+    for (size_t i = tick + 1; i < tick_tree.size(); i += i & -i)
+        tick_tree[i] += n;
+}
+
+// The number of shadow lines with a tick <= tick
+uint64_t miss_analyzer_t::ticks_upto(uint64_t tick) const {
+    uint64_t n = 0;
+    for (size_t i = tick + 1; i; i -= i & -i)
+        n += tick_tree[i];
+    return n;
+}
+
+// Renumbers the shadow lines' ticks 0..live-1 in the same order
+void miss_analyzer_t::renumber_ticks() {
+    std::vector<std::pair<uint64_t, size_t>> order;
+    for (size_t way = 0; way < shadow_keys.size(); way++) {
+        if (shadow_keys[way])
+            order.push_back(std::make_pair(shadow_tick[way], way));
+    }
+    std::sort(order.begin(), order.end());
+
+    std::fill(tick_tree.begin(), tick_tree.end(), 0);
+    for (size_t i = 0; i < order.size(); i++) {
+        shadow_tick[order[i].second] = i;
+        tick_add(i, 1);
+    }
+    next_tick = order.size();
+}
+
+// Marks line as touched, returning whether it had been touched before
+bool miss_analyzer_t::touch_first(uint64_t line) {
+    uint64_t key = line >> PAGE_SHIFT;
+    if (key != last_page_key) {
+        std::vector<uint64_t> &page = pages[key];
+        if (page.empty())
+            page.assign((1 << PAGE_SHIFT) / 64, 0);
+        last_page_key = key;
+        last_page = &page[0];
+    }
+
+    uint64_t bit = line & ((1 << PAGE_SHIFT) - 1);
+    uint64_t &word = last_page[bit / 64];
+    bool seen = (word >> (bit % 64)) & 1;
+    word |= 1ULL << (bit % 64);
+    return seen;
+}
+
+void miss_analyzer_t::access(uint64_t addr, bool miss) {
+    uint64_t line = addr >> idx_shift;
+    bool seen = touch_first(line);
+    now++;
+    if (next_tick + 1 == tick_tree.size())
+        renumber_ticks();
+
+    size_t way = shadow_index.find(line + 1);
+    bool shadow_hit = way != tag_index_t::NONE;
+    if (shadow_hit) {
+        uint64_t d = live - ticks_upto(shadow_tick[way]);
+        distance[d ? 64 - __builtin_clzll(d) : 0]++;
+        reuse[63 - __builtin_clzll(now - shadow_time[way])]++;
+        shadow_repl.touch(0, way);
+        tick_add(shadow_tick[way], -1);
+    } else {
+        if (seen)
+            beyond++;
+        way = shadow_repl.victim(0);
+        if (shadow_keys[way]) {
+            shadow_index.erase(shadow_keys[way]);
+            tick_add(shadow_tick[way], -1);
+        } else {
+            live++;
+        }
+        shadow_keys[way] = line + 1;
+        shadow_index.insert(line + 1, way);
+        shadow_repl.fill(0, way);
+    }
+    shadow_time[way] = now;
+    shadow_tick[way] = next_tick;
+    tick_add(next_tick++, 1);
+
+    if (!miss)
+        return;
+
+    set_misses[line & (sets - 1)]++;
+    if (!seen)
+        compulsory++;
+    else if (shadow_hit)
+        conflict++;
+    else
+        capacity++;
+}
+
+static void print_row(const std::string &name, const std::string &label, uint64_t value) {
+    std::cout << name << " " << std::left << std::setw(22) << label + ":" << " " << std::right
+              << value << std::endl;
+}
+
+static std::string range(uint64_t lo, uint64_t hi) {
+    return lo == hi ? std::to_string(lo) : std::to_string(lo) + "-" + std::to_string(hi);
+}
+
+void miss_analyzer_t::print(const std::string &name) const {
+    for (size_t b = 0; b < distance.size(); b++) {
+        if (distance[b])
+            print_row(name, "Reuse Distance " + (b ? range(1ULL << (b - 1), (1ULL << b) - 1) : "0"),
+                      distance[b]);
+    }
+    for (size_t b = 0; b < REUSE_BUCKETS; b++) {
+        if (reuse[b])
+            print_row(name, "Reuse Time " + range(1ULL << b, (2ULL << b) - 1), reuse[b]);
+    }
+    print_row(name, "Reuse Beyond Capacity", beyond);
 
-    if (store)
-        *check_tag(addr) |= DIRTY;
+    // sets by number of misses: none, then [2^(b-1), 2^b)
+    std::vector<uint64_t> hist(REUSE_BUCKETS + 1, 0);
+    size_t busiest = 0;
+    for (size_t i = 0; i < sets; i++) {
+        uint64_t m = set_misses[i];
+        hist[m ? 64 - __builtin_clzll(m) : 0]++;
+        if (m > set_misses[busiest])
+            busiest = i;
+    }
+    for (size_t b = 0; b < hist.size(); b++) {
+        if (hist[b])
+            print_row(name, "Sets Missing " + (b ? range(1ULL << (b - 1), (1ULL << b) - 1) : "0"), hist[b]);
+    }
+    print_row(name, "Busiest Set", busiest);
+    print_row(name, "Busiest Set Misses", set_misses[busiest]);
 }
 
-fa_cache_sim_t::fa_cache_sim_t(size_t ways, size_t linesz, const char *name)
-    : cache_sim_t(1, ways, linesz, name) {
+set_sampler_t::set_sampler_t(size_t sets, size_t sample)
+    : read_accesses(0), write_accesses(0), is_sampled(sets, 0), accesses(sets, 0), misses(sets, 0) {
+    // the sets with the smallest hashes, so strided layouts do not line up
+    // with the sample
+    std::vector<std::pair<uint64_t, size_t>> order;
+    for (size_t i = 0; i < sets; i++)
+        order.push_back(std::make_pair((i + 1) * 0x9e3779b97f4a7c15ULL, i));
+    nsampled = std::max<size_t>(sets / sample, 1);
+    std::nth_element(order.begin(), order.begin() + nsampled - 1, order.end());
+    for (size_t i = 0; i < nsampled; i++)
+        is_sampled[order[i].second] = 1;
 }
 
-uint64_t *fa_cache_sim_t::check_tag(uint64_t addr) {
-    size_t tag = (addr >> idx_shift) | VALID;
+double set_sampler_t::miss_rate_ci() const {
+    size_t n = nsampled;
+    size_t total = is_sampled.size();
+    uint64_t a = read_accesses + write_accesses, m = 0;
+    for (size_t i = 0; i < total; i++)
+        m += misses[i];
+    if (n < 2 || a == 0)
+        return 0;
 
-    for (size_t i = 0; i < ways; i++) {
-        if (tag == (tags[i] & ~DIRTY)) {
-            time_stamp[i] = curr_time++;
-            return &tags[i];
+    // variance of the ratio estimator m/a over n of total sets
+    double r = double(m) / a, abar = double(a) / n, ss = 0;
+    for (size_t i = 0; i < total; i++) {
+        if (is_sampled[i]) {
+            double d = misses[i] - r * accesses[i];
+            ss += d * d;
         }
     }
+    double var = (1 - double(n) / total) * ss / (n - 1) / (n * abar * abar);
+    return 100 * 1.96 * sqrt(var);
+}
 
-    return NULL;
-    // original code
-    // auto it = tags.find(addr >> idx_shift);
-    // return it == tags.end() ? NULL : &it->second;
+cache_timing_t::cache_timing_t(const cache_config_t &c)
+    : latency(c.latency), mem_latency(c.mem_latency), transfer((c.linesz + c.mem_bw - 1) / c.mem_bw),
+      mshrs(c.mshrs, mshr_t{0, 0}), wbuf(c.wbuf), mem_free(0), clock(0), arrival(0), request(0), mshr(0),
+      wait(0), done(0), latency_cycles(0), stall_cycles(0), merges(0), mshr_stall_cycles(0),
+      wbuf_stall_cycles(0) {
 }
 
-uint64_t fa_cache_sim_t::victimize(uint64_t addr) {
-    uint64_t lru_time = time_stamp[0];
-    uint64_t lru_index = 0;
+// Returns when the access in progress reaches this cache: the next cycle
+// of the core clock at the top of the hierarchy, or when the cache above
+// sent it
+uint64_t cache_sim_t::timing_start() {
+    timing->wait = 0;
+    if (!uppers.empty())
+        return timing->arrival;
+
+    cache_sim_t *last = this;
+    while (last->miss_handler)
+        last = last->miss_handler;
+    return ++last->timing->clock;
+}
 
-    // loop to find the least recently used cache line
-    for (uint64_t i = 0; i < ways; i++) {
-        if (time_stamp[i] < lru_time) {
-            lru_time = time_stamp[i];
-            lru_index = i;
+void cache_sim_t::timing_hit(uint64_t addr, uint64_t t, bool store) {
+    uint64_t line_addr = addr & ~(linesz - 1);
+    uint64_t done = t + timing->latency;
+    for (auto &m : timing->mshrs) {
+        if (m.line == line_addr && m.ready > done) {
+            timing->merges++;
+            done = m.ready;
         }
     }
+    timing_finish(t, done, store);
+}
+
+// Takes the MSHR that frees up first for a miss that arrived at t
+void cache_sim_t::timing_miss(uint64_t t) {
+    auto &mshrs = timing->mshrs;
+    size_t m = 0;
+    for (size_t i = 1; i < mshrs.size(); i++)
+        if (mshrs[i].ready < mshrs[m].ready)
+            m = i;
+
+    timing->request = t + timing->latency;
+    if (mshrs[m].ready > timing->request) {
+        timing->mshr_stall_cycles += mshrs[m].ready - timing->request;
+        timing->wait += mshrs[m].ready - timing->request;
+        timing->request = mshrs[m].ready;
+    }
+    timing->mshr = m;
+}
+
+void cache_sim_t::timing_fill(uint64_t addr, uint64_t t, bool store, bool supplied) {
+    uint64_t done;
+    if (supplied)
+        done = timing->request + timing->latency;
+    else if (miss_handler)
+        done = miss_handler->timing->done;
+    else
+        done = timing_memory(timing->request);
+
+    timing->mshrs[timing->mshr] = cache_timing_t::mshr_t{addr & ~(linesz - 1), done};
+    timing_finish(t, done, store);
+}
+
+// Sends a writeback on through the write buffer, delaying the miss that
+// caused it while the buffer is full (or for the whole writeback if there
+// is no buffer)
+void cache_sim_t::timing_writeback(uint64_t addr) {
+    auto &drain = timing->wbuf_drain;
+    while (!drain.empty() && drain.front() <= timing->request)
+        drain.pop_front();
+    if (timing->wbuf && drain.size() == timing->wbuf) {
+        timing->wbuf_stall_cycles += drain.front() - timing->request;
+        timing->wait += drain.front() - timing->request;
+        timing->request = drain.front();
+        drain.pop_front();
+    }
 
-    tags[lru_index] = (addr >> idx_shift) | VALID;
-    uint64_t victim = tags[lru_index];
+    // entries drain one after another
+    uint64_t start = drain.empty() ? timing->request : std::max(timing->request, drain.back());
+    uint64_t done;
+    if (miss_handler) {
+        miss_handler->timing->arrival = start;
+        miss_handler->access(addr, linesz, true);
+        done = miss_handler->timing->done;
+    } else {
+        done = timing_memory(start);
+    }
+
+    if (timing->wbuf)
+        drain.push_back(done);
+    else
+        timing->request = done;
+}
+
+// Returns when memory has sent a line requested at t
+uint64_t cache_sim_t::timing_memory(uint64_t t) {
+    uint64_t start = std::max(t, timing->mem_free);
+    timing->mem_free = start + timing->transfer;
+    return start + timing->mem_latency + timing->transfer;
+}
 
-    // update time stamp of the least recently used cache line
-    time_stamp[lru_index] = curr_time++;
+void cache_sim_t::timing_finish(uint64_t t, uint64_t done, bool store) {
+    timing->done = done;
+    timing->latency_cycles += done - t;
+    if (!uppers.empty())
+        return;
+
+    // the core waits for load data, but stores only for MSHRs and the write
+    // buffer
+    uint64_t stall = store ? timing->wait : done - t - timing->latency;
+    cache_sim_t *last = this;
+    while (last->miss_handler)
+        last = last->miss_handler;
+    last->timing->clock += stall;
+    timing->stall_cycles += stall;
+}
+
+void tag_index_t::init(size_t entries) {
+    // keep the load factor at or below one half
+    size_t n = 2;
+    shift = 63;
+    while (n < 2 * entries) {
+        n <<= 1;
+        shift--;
+    }
+    slots.assign(n, entry_t{0, 0});
+    mask = n - 1;
+}
+
+void tag_index_t::insert(uint64_t key, size_t way) {
+    size_t i = slot(key);
+    while (slots[i].key)
+        i = (i + 1) & mask;
+    slots[i].key = key;
+    slots[i].way = way;
+}
+
+void tag_index_t::erase(uint64_t key) {
+    size_t i = slot(key);
+    while (slots[i].key != key)
+        i = (i + 1) & mask;
+
+    // shift later members of the probe run back into the hole
+    for (size_t j = (i + 1) & mask; slots[j].key; j = (j + 1) & mask) {
+        size_t home = slot(slots[j].key);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i].key = 0;
+}
+
+stack_dist_sim_t::stack_dist_sim_t(size_t _sets, size_t max_ways, size_t _linesz)
+    : sets(_sets), ways(max_ways), linesz(_linesz) {
+    if (sets == 0 || (sets & (sets - 1)))
+        help();
+    if (linesz < 8 || (linesz & (linesz - 1)))
+        help();
+    if (ways == 0 || ways >= CLEAN)
+        help();
 
-    return victim;
+    idx_shift = 0;
+    for (size_t x = linesz; x > 1; x >>= 1)
+        idx_shift++;
+
+    stack.assign(sets * ways, 0);
+    dirty_depth.assign(sets * ways, uint32_t(CLEAN));
+    read_hits.assign(ways, 0);
+    write_hits.assign(ways, 0);
+    writebacks.assign(ways + 1, 0);
+
+    read_accesses = 0;
+    bytes_read = 0;
+    write_accesses = 0;
+    bytes_written = 0;
+}
+
+void stack_dist_sim_t::access(uint64_t addr, size_t bytes, bool store) {
+    store ? write_accesses++ : read_accesses++;
+    (store ? bytes_written : bytes_read) += bytes;
+
+    size_t idx = (addr >> idx_shift) & (sets - 1);
+    uint64_t tag = (addr >> idx_shift) | VALID;
+    uint64_t *s = &stack[idx * ways];
+    uint32_t *d = &dirty_depth[idx * ways];
+
+    size_t depth = 0;
+    while (depth < ways && s[depth] != tag && s[depth] != 0)
+        depth++;
+
+    uint32_t new_depth = store ? 0 : CLEAN;
+    if (depth < ways && s[depth] == tag) {
+        (store ? write_hits : read_hits)[depth]++;
+        if (!store)
+            new_depth = d[depth];
+    } else if (depth == ways) {
+        // the bottom line falls out of every cache in the group
+        depth--;
+        if (ways > d[depth])
+            writebacks[ways]++;
+    }
+
+    // push the lines above down by one; the cache with k+1 ways loses the
+    // line moving to depth k+1, writing it back if it is still dirty there
+    for (size_t k = depth; k-- > 0;) {
+        if (k + 1 > d[k]) {
+            writebacks[k + 1]++;
+            d[k] = k + 1;
+        }
+        s[k + 1] = s[k];
+        d[k + 1] = d[k];
+    }
+
+    s[0] = tag;
+    d[0] = new_depth;
+}
+
+cache_stats_t stack_dist_sim_t::stats(size_t w) const {
+    uint64_t rh = 0, wh = 0;
+    for (size_t i = 0; i < w; i++) {
+        rh += read_hits[i];
+        wh += write_hits[i];
+    }
+
+    cache_stats_t s = cache_stats_t();
+    s.read_accesses = read_accesses;
+    s.read_misses = read_accesses - rh;
+    s.bytes_read = bytes_read;
+    s.write_accesses = write_accesses;
+    s.write_misses = write_accesses - wh;
+    s.bytes_written = bytes_written;
+    s.writebacks = writebacks[w];
+    // every miss fills a whole line and every writeback is one
+    s.fill_bytes = (s.read_misses + s.write_misses) * linesz;
+    s.writeback_bytes = s.writebacks * linesz;
+    return s;
+}
+
+// The stack only models a write-back, write-allocate LRU cache with none of
+// the options; any other field would be parsed and then silently ignored
+static bool plain_lru(const cache_config_t &c) {
+    cache_config_t d = cache_config_t::parse(c.str().c_str());
+    return (c.policy == "lru" || c.policy == "lru_ts") && c.incl == d.incl && c.write_through == d.write_through &&
+           c.write_allocate == d.write_allocate && c.wcb == d.wcb && c.vc == d.vc && c.sector == d.sector &&
+           c.pf == d.pf && c.pf_degree == d.pf_degree && c.pf_table == d.pf_table && c.pf_streams == d.pf_streams &&
+           c.pf_delay == d.pf_delay && c.analyze == d.analyze && c.sample == d.sample && c.attr == d.attr &&
+           c.attr_range == d.attr_range && c.latency == d.latency && c.mshrs == d.mshrs && c.wbuf == d.wbuf &&
+           c.mem_latency == d.mem_latency && c.mem_bw == d.mem_bw && c.stats == d.stats &&
+           c.interval == d.interval;
+}
+
+cache_sweep_memtracer_t::cache_sweep_memtracer_t(const char *list, const char *_name)
+    : name(_name) {
+    std::vector<cache_config_t> cs;
+    for (const char *p = list; *p;) {
+        const char *e = strchr(p, ',');
+        std::string config = e ? std::string(p, e) : std::string(p);
+        cs.push_back(cache_config_t::parse(config.c_str()));
+        if (!plain_lru(cs.back()))
+            help();
+        p = e ? e + 1 : p + config.size();
+    }
+    if (cs.empty())
+        help();
+
+    // one stack per (sets, blocksize), as deep as its largest associativity
+    for (auto &c : cs) {
+        stack_dist_sim_t *group = NULL;
+        size_t max_ways = 0;
+        for (auto &o : cs) {
+            if (o.sets == c.sets && o.linesz == c.linesz)
+                max_ways = std::max(max_ways, o.ways);
+        }
+        for (auto g : groups) {
+            if (g->get_sets() == c.sets && g->get_linesz() == c.linesz)
+                group = g;
+        }
+        if (!group) {
+            group = new stack_dist_sim_t(c.sets, max_ways, c.linesz);
+            groups.push_back(group);
+        }
+        configs.push_back(std::make_pair(c, group));
+    }
+}
 
-    // original code
-    // uint64_t old_tag = 0;
-    // if (tags.size() == ways) {
-    // auto it = tags.begin();
-    // std::advance(it, lfsr.next() % ways);
-    // old_tag = it->second;
-    // tags.erase(it);
-    // }
-    // tags[addr >> idx_shift] = (addr >> idx_shift) | VALID;
-    // return old_tag;
+cache_sweep_memtracer_t::~cache_sweep_memtracer_t() {
+    for (auto &c : configs)
+        c.second->stats(c.first.ways).print(name + "[" + c.first.str() + "]");
+    for (auto g : groups)
+        delete g;
 }
\ No newline at end of file
@@ -4,44 +4,522 @@
 #define _RISCV_CACHE_SIM_H
 
 #include "memtracer.h"
+#include "cacherepl.h"
+#include "cachepf.h"
+#include "cacheattr.h"
+#include <algorithm>
 #include <cstring>
+#include <deque>
+#include <memory>
 #include <string>
-#include <map>
+#include <unordered_map>
+#include <vector>
 #include <cstdint>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
 
-class lfsr_t
+// Open-addressing (linear probing) map from a valid tag to the way holding
+// it. Keys always carry cache_sim_t::VALID, so a zero key marks an empty
+// slot, and erase uses backward-shift deletion so no tombstones build up.
+class tag_index_t
 {
  public:
-  lfsr_t() : reg(1) {}
-  lfsr_t(const lfsr_t& lfsr) : reg(lfsr.reg) {}
-  uint32_t next() { return reg = (reg>>1)^(-(reg&1) & 0xd0000001); }
+  static const size_t NONE = SIZE_MAX;
+
+  void init(size_t entries);
+  size_t find(uint64_t key) const
+  {
+    for (size_t i = slot(key); slots[i].key; i = (i + 1) & mask)
+      if (slots[i].key == key)
+        return slots[i].way;
+    return NONE;
+  }
+  void insert(uint64_t key, size_t way);
+  void erase(uint64_t key);
  private:
-  uint32_t reg;
+  struct entry_t {
+    uint64_t key;
+    uint64_t way;
+  };
+
+  size_t slot(uint64_t key) const
+  {
+    return (key * 0x9e3779b97f4a7c15ULL) >> shift;
+  }
+
+  std::vector<entry_t> slots;
+  size_t mask;
+  unsigned shift;
 };
 
+// Returns the way of tags[0, ways) holding tag, or ways if none does. Built
+// with AVX2 or SSE4.1 (e.g. -march=native) it compares four or two ways
+// per instruction, and only branches once per 32 ways: which way matches
+// is unpredictable, but how many compares a set takes is not.
+static inline size_t find_tag(const uint64_t* tags, size_t ways, uint64_t tag)
+{
+  size_t i = 0;
+#if defined(__AVX2__)
+  __m256i key = _mm256_set1_epi64x(tag);
+  while (i + 4 <= ways) {
+    size_t base = i;
+    uint32_t mask = 0;
+    for (; i + 4 <= ways && i - base < 32; i += 4) {
+      __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(tags + i)), key);
+      mask |= uint32_t(_mm256_movemask_pd(_mm256_castsi256_pd(eq))) << (i - base);
+    }
+    if (mask)
+      return base + __builtin_ctz(mask);
+  }
+#elif defined(__SSE4_1__)
+  __m128i key = _mm_set1_epi64x(tag);
+  while (i + 2 <= ways) {
+    size_t base = i;
+    uint32_t mask = 0;
+    for (; i + 2 <= ways && i - base < 32; i += 2) {
+      __m128i eq = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)(tags + i)), key);
+      mask |= uint32_t(_mm_movemask_pd(_mm_castsi128_pd(eq))) << (i - base);
+    }
+    if (mask)
+      return base + __builtin_ctz(mask);
+  }
+#endif
+  for (; i < ways; i++)
+    if (tags[i] == tag)
+      return i;
+  return ways;
+}
+
+// FIFO in a ring allocated up front, for the small buffers the access path
+// searches and updates (write-combining buffer, victim cache, prefetches in
+// flight). Entries are indexed oldest first; erase moves the newer ones down
+// to keep the order. Pushing while full doubles the ring, so capacity only
+// needs to be a bound in the common case.
+template <class T>
+class fifo_t
+{
+ public:
+  explicit fifo_t(size_t capacity = 0) : ring(capacity), head(0), count(0) {}
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  T& operator[](size_t i) { return ring[wrap(head + i)]; }
+  const T& operator[](size_t i) const { return ring[wrap(head + i)]; }
+  T& front() { return ring[head]; }
+  T& back() { return (*this)[count - 1]; }
+
+  void push_back(const T& x)
+  {
+    if (count == ring.size())
+      grow();
+    ring[wrap(head + count++)] = x;
+  }
+  void pop_front()
+  {
+    head = wrap(head + 1);
+    count--;
+  }
+  void erase(size_t i)
+  {
+    for (; i + 1 < count; i++)
+      (*this)[i] = (*this)[i + 1];
+    count--;
+  }
+
+ private:
+  size_t wrap(size_t i) const { return i < ring.size() ? i : i - ring.size(); }
+  void grow()
+  {
+    std::vector<T> bigger(std::max<size_t>(2 * ring.size(), 1));
+    for (size_t i = 0; i < count; i++)
+      bigger[i] = (*this)[i];
+    ring.swap(bigger);
+    head = 0;
+  }
+
+  std::vector<T> ring;
+  size_t head;
+  size_t count;
+};
+
+// A parsed sets:ways:blocksize[:policy][:key=value...] configuration string
+struct cache_config_t
+{
+  // how a cache relates to the caches whose misses it handles: inclusive
+  // caches hold a superset of their contents, exclusive caches only hold
+  // lines those caches evicted, and NINE caches do neither
+  enum incl_t { NINE, INCLUSIVE, EXCLUSIVE };
+
+  size_t sets;
+  size_t ways;
+  size_t linesz;
+  std::string policy;
+  incl_t incl;
+
+  // write-through instead of write-back, write-allocate, and entries of the
+  // write-combining buffer in front of the next level (0 for none)
+  bool write_through;
+  bool write_allocate;
+  size_t wcb;
+
+  // lines in the victim cache (0 for none), and the sector size of
+  // sectored lines (0 for whole lines)
+  size_t vc;
+  size_t sector;
+
+  // prefetcher (next, stride, stream or empty for none) and its degree,
+  // stride table entries, stream buffer count and fill delay in accesses
+  std::string pf;
+  size_t pf_degree;
+  size_t pf_table;
+  size_t pf_streams;
+  size_t pf_delay;
+
+  // classify misses and keep reuse and per-set miss histograms
+  bool analyze;
+  // simulate one in sample sets (1 simulates them all)
+  size_t sample;
+  // print the top attr miss PCs and attr_range-byte address ranges (0
+  // for none)
+  size_t attr;
+  size_t attr_range;
+
+  // timing, off while latency is 0: hit latency, MSHRs and write buffer
+  // entries, and for the last level the memory latency and bytes per cycle
+  unsigned latency;
+  size_t mshrs;
+  size_t wbuf;
+  unsigned mem_latency;
+  size_t mem_bw;
+
+  // stats time series file (none if empty) and accesses per record (0
+  // writes only the summary, or records when the caller asks)
+  std::string stats;
+  size_t interval;
+
+  static cache_config_t parse(const char* config);
+  std::string str() const;
+};
+
+struct cache_stats_t
+{
+  uint64_t read_accesses;
+  uint64_t read_misses;
+  uint64_t bytes_read;
+  uint64_t write_accesses;
+  uint64_t write_misses;
+  uint64_t bytes_written;
+  uint64_t writebacks;
+  // bytes read from the next level to fill lines (demand misses, sectors
+  // and prefetches) and written back to it as dirty lines or sectors
+  uint64_t fill_bytes;
+  uint64_t writeback_bytes;
+  uint64_t back_invalidations;
+  uint64_t victim_fills;
+  // bytes of stores sent on by write-through and around the cache without
+  // write-allocate, and what the write-combining buffer made of them
+  uint64_t write_through_bytes;
+  uint64_t write_around_bytes;
+  uint64_t wcb_merges;
+  uint64_t wcb_flushes;
+  uint64_t wcb_bytes;
+  // misses served by the victim cache, and misses on a line whose tag was
+  // present but not the sectors accessed
+  uint64_t vc_hits;
+  uint64_t sector_misses;
+  uint64_t upgrades;
+  uint64_t coherence_invalidations;
+  uint64_t interventions;
+  uint64_t coherence_misses;
+  uint64_t false_sharing_misses;
+  uint64_t pf_issued;
+  uint64_t pf_useful;
+  uint64_t pf_late;
+  uint64_t pf_useless;
+  uint64_t pf_unused;
+  uint64_t compulsory_misses;
+  uint64_t capacity_misses;
+  uint64_t conflict_misses;
+  // set sampling: sets simulated, and the half-width of the 95% confidence
+  // interval of the miss rate in percent
+  uint64_t sampled_sets;
+  uint64_t total_sets;
+  double miss_rate_ci;
+  // timing: the sum of access latencies, the cycles the core stalled on
+  // this cache, and the core clock if this is the last level
+  uint64_t latency_cycles;
+  uint64_t stall_cycles;
+  uint64_t core_cycles;
+  uint64_t mshr_merges;
+  uint64_t mshr_stall_cycles;
+  uint64_t wbuf_stall_cycles;
+
+  void print(const std::string& name) const;
+};
+
+// Classifies the misses of a cache as compulsory (first touch of the line),
+// capacity (a fully associative LRU cache of the same size misses too) or
+// conflict (only the real cache misses). Also histograms, in power-of-two
+// buckets, the reuse distance (distinct lines touched in between, i.e. the
+// LRU stack depth) and reuse time (accesses in between) of lines that stay
+// in the shadow cache, and the number of misses per set.
+class miss_analyzer_t
+{
+ public:
+  miss_analyzer_t(size_t sets, size_t ways, size_t linesz);
+
+  void access(uint64_t addr, bool miss);
+  void print(const std::string& name) const;
+
+  uint64_t compulsory;
+  uint64_t capacity;
+  uint64_t conflict;
+
+ private:
+  static const unsigned PAGE_SHIFT = 15;  // lines per first-touch page
+  static const size_t REUSE_BUCKETS = 64;
+
+  bool touch_first(uint64_t line);
+  // Fenwick tree over the shadow lines' access ticks
+  void tick_add(uint64_t tick, int32_t n);
+  uint64_t ticks_upto(uint64_t tick) const;
+  void renumber_ticks();
+
+  size_t sets;
+  size_t idx_shift;
+
+  // first-touch bitset, one lazily allocated page per 2^PAGE_SHIFT lines
+  std::unordered_map<uint64_t, std::vector<uint64_t>> pages;
+  uint64_t last_page_key;
+  uint64_t* last_page;
+
+  // the shadow cache: line + 1 and last access time per way
+  tag_index_t shadow_index;
+  lru_repl_t shadow_repl;
+  std::vector<uint64_t> shadow_keys;
+  std::vector<uint64_t> shadow_time;
+  uint64_t now;
+
+  // Every shadow line since its last access is more recent than it and
+  // still in the shadow, so a line's reuse distance is the number of
+  // shadow lines with a later tick. Ticks count up from 0 and are
+  // renumbered by rank once they reach twice the shadow's size, keeping
+  // the tree small at O(log n) per access (Bennett and Kruskal).
+  std::vector<uint64_t> shadow_tick;
+  std::vector<uint32_t> tick_tree;
+  uint64_t next_tick;
+  uint64_t live;
+
+  // distance[0] counts reuses with no other line in between and
+  // distance[b] those after [2^(b-1), 2^b) lines; reuse[b] counts reuses
+  // after [2^b, 2^(b+1)) accesses; beyond counts lines touched again after
+  // falling out of the shadow cache
+  std::vector<uint64_t> distance;
+  std::vector<uint64_t> reuse;
+  uint64_t beyond;
+  std::vector<uint64_t> set_misses;
+};
+
+// Set sampling: only a pseudo-random subset of the sets is simulated, and
+// the misses and writebacks of the whole cache are estimated from theirs.
+// The sampled sets are a cluster sample of the cache, so the per-set
+// access and miss counts give a confidence interval for the miss rate.
+class set_sampler_t
+{
+ public:
+  set_sampler_t(size_t sets, size_t sample);
+
+  bool sampled(size_t set) const { return is_sampled[set]; }
+  void access(size_t set, bool store)
+  {
+    accesses[set]++;
+    store ? write_accesses++ : read_accesses++;
+  }
+  void miss(size_t set) { misses[set]++; }
+  // the 95% confidence interval half-width of the miss rate, in percent
+  double miss_rate_ci() const;
+
+  size_t nsampled;
+  uint64_t read_accesses;
+  uint64_t write_accesses;
+
+ private:
+  std::vector<uint8_t> is_sampled;
+  std::vector<uint64_t> accesses;
+  std::vector<uint64_t> misses;
+};
+
+// Latency model of a cache, in core cycles. The caches at the top of a
+// hierarchy issue one access per cycle on a core clock kept by its last
+// level; loads stall the core until their data arrives, stores only while
+// they wait for an MSHR or a write buffer entry. A miss holds an MSHR until
+// its fill arrives, and a hit on a line still being filled waits for the
+// fill (a merged miss). Writebacks drain through the write buffer one at a
+// time, or hold up the miss if there is none. Behind the last level,
+// memory answers after mem_latency cycles plus the transfer of the line at
+// mem_bw bytes per cycle, one transfer at a time.
+struct cache_timing_t
+{
+  cache_timing_t(const cache_config_t& c);
+
+  unsigned latency;
+  unsigned mem_latency;
+  uint64_t transfer;
+
+  struct mshr_t {
+    uint64_t line;
+    uint64_t ready;
+  };
+  std::vector<mshr_t> mshrs;
+  size_t wbuf;
+  std::deque<uint64_t> wbuf_drain;
+  uint64_t mem_free;
+
+  uint64_t clock;
+  // the request in progress: when it reached this cache, when it is sent
+  // on (after any MSHR or write buffer wait), which MSHR it holds, how long
+  // it waited for one, and when its data is ready
+  uint64_t arrival;
+  uint64_t request;
+  size_t mshr;
+  uint64_t wait;
+  uint64_t done;
+
+  uint64_t latency_cycles;
+  uint64_t stall_cycles;
+  uint64_t merges;
+  uint64_t mshr_stall_cycles;
+  uint64_t wbuf_stall_cycles;
+};
+
+class coherence_bus_t;
+class cache_stats_writer_t;
+
 class cache_sim_t
 {
+  friend class coherence_bus_t;
+
  public:
   cache_sim_t(size_t sets, size_t ways, size_t linesz, const char* name);
   cache_sim_t(const cache_sim_t& rhs);
   virtual ~cache_sim_t();
 
-  void access(uint64_t addr, size_t bytes, bool store);
+  virtual void access(uint64_t addr, size_t bytes, bool store) = 0;
   void print_stats();
-  void set_miss_handler(cache_sim_t* mh) { miss_handler = mh; }
+  cache_stats_t stats() const;
+  // the read misses so far, unscaled: with sample, those of the sampled
+  // sets. Cheaper than stats() for callers that count misses per access
+  uint64_t read_misses() const { return misses[0]; }
+  void set_miss_handler(cache_sim_t* mh);
+  void set_prefetcher(prefetcher_t* _pf, size_t delay);
+  // keep this cache coherent with the other caches on bus (see cachecoh.h)
+  void set_bus(coherence_bus_t* bus);
   void set_log(bool _log) { log = _log; }
+  // don't print stats on destruction; callers read stats() themselves
+  void set_quiet(bool _quiet) { quiet = _quiet; }
+  // ends a stats interval at instruction count insns, if this cache has a
+  // stats file (see cachestats.h)
+  void snapshot(uint64_t insns);
+  // the PC of the instruction making the accesses that follow, for miss
+  // attribution and the stride prefetcher; the next levels are told on a
+  // miss
+  void set_pc(uint64_t _pc) { pc = _pc; }
+  // one more instruction fetched, for the records of stats intervals that
+  // end by access count; the next levels are told too
+  void count_insn();
+  // whether this cache or one below it attributes misses to PCs, keys its
+  // prefetcher by them or ends stats intervals by access count
+  bool wants_pc() const;
 
   static cache_sim_t* construct(const char* config, const char* name);
 
  protected:
+  // Lines are kept as parallel arrays of tags, dirty bits, prefetched bits
+  // and, for coherent caches, shared bits, indexed by set * ways + way; an
+  // invalid line has tag NO_TAG.
+  // victimize and invalidate give a line packed into one word, as
+  // VALID | DIRTY | PREFETCHED | tag, or 0 for an invalid line.
+  static const uint64_t NO_TAG = UINT64_MAX;
+  static const size_t NO_LINE = SIZE_MAX;
   static const uint64_t VALID = 1ULL << 63;
   static const uint64_t DIRTY = 1ULL << 62;
+  static const uint64_t PREFETCHED = 1ULL << 61;
+  static const uint64_t STATUS = DIRTY | PREFETCHED;
+
+  uint64_t pack(size_t line) const
+  {
+    if (tags[line] == NO_TAG)
+      return 0;
+    return VALID | tags[line] | (dirty[line] ? DIRTY : 0) | (prefetched[line] ? PREFETCHED : 0);
+  }
+  void fill_line(size_t line, uint64_t tag)
+  {
+    tags[line] = tag;
+    dirty[line] = 0;
+    prefetched[line] = 0;
+    shared[line] = 0;
+    if (sector_valid) {
+      victim_valid_sectors = sector_valid[line];
+      victim_dirty_sectors = sector_dirty[line];
+      sector_valid[line] = 0;
+      sector_dirty[line] = 0;
+    }
+  }
+
+  // whether line still holds addr; a next level taking lines back from the
+  // caches above can empty a line between its fill and its first use
+  bool holds(size_t line, uint64_t addr) const { return tags[line] == addr >> idx_shift; }
+
+  // the body of access, calling the tag lookups of cache_t directly so
+  // that they inline; cache_t::access forwards to it
+  template <class cache_t>
+  void access_as(uint64_t addr, size_t bytes, bool store);
+
+  // the line holding addr, or NO_LINE
+  virtual size_t check_tag(uint64_t addr) = 0;
+  // like check_tag, but leaves the replacement state alone
+  virtual size_t probe_tag(uint64_t addr) = 0;
+  // fills a line with addr, returning it, and the line it held in victim
+  virtual size_t victimize(uint64_t addr, uint64_t& victim) = 0;
+  // empties the line holding addr, returning its old tag (0 if absent)
+  virtual uint64_t invalidate(uint64_t addr) = 0;
 
-  virtual uint64_t* check_tag(uint64_t addr);
-  virtual uint64_t victimize(uint64_t addr);
+  void evict(uint64_t victim);
+  uint64_t fetch(uint64_t addr);
+  void insert_victim(uint64_t addr, bool victim_dirty);
+  uint64_t back_invalidate(uint64_t addr, size_t bytes);
+
+  void prefetch_hit(uint64_t addr, size_t line);
+  bool prefetch_take(uint64_t addr, bool store);
+  bool prefetch_inflight(uint64_t line_addr) const;
+  bool prefetch_cancel(uint64_t addr);
+  void prefetch_arrive();
+  void prefetch_observe(uint64_t addr, bool miss, bool first_use);
+  void prefetch_issue();
+  void prefetch_fill(uint64_t addr);
+
+  void write_next(uint64_t addr, size_t bytes);
+  void wcb_init(size_t entries);
+  void wcb_flush(uint64_t addr);
+
+  uint64_t vc_take(uint64_t addr);
+  uint64_t sector_mask(uint64_t addr, size_t bytes) const;
+  void sector_miss(size_t line, uint64_t addr, size_t bytes, bool store, size_t set);
+  void sector_transfer(uint64_t line_addr, uint64_t sectors, bool store);
+
+  uint64_t timing_start();
+  void timing_hit(uint64_t addr, uint64_t t, bool store);
+  void timing_miss(uint64_t t);
+  void timing_fill(uint64_t addr, uint64_t t, bool store, bool supplied);
+  void timing_writeback(uint64_t addr);
+  uint64_t timing_memory(uint64_t t);
+  void timing_finish(uint64_t t, uint64_t done, bool store);
 
-  lfsr_t lfsr;
   cache_sim_t* miss_handler;
+  // caches whose miss handler this cache is
+  std::vector<cache_sim_t*> uppers;
+  cache_config_t::incl_t incl;
 
   size_t sets;
   size_t ways;
@@ -49,35 +527,229 @@ class cache_sim_t
   size_t idx_shift;
 
   uint64_t* tags;
+  uint8_t* dirty;
+  uint8_t* prefetched;
+  uint8_t* shared;
 
-  uint64_t read_accesses;
-  uint64_t read_misses;
-  uint64_t bytes_read;
-  uint64_t write_accesses;
-  uint64_t write_misses;
-  uint64_t bytes_written;
+  // indexed by whether the access is a store
+  uint64_t accesses[2];
+  uint64_t misses[2];
+  uint64_t bytes_accessed[2];
   uint64_t writebacks;
+  uint64_t fill_bytes;
+  uint64_t writeback_bytes;
+  uint64_t back_invalidations;
+  uint64_t victim_fills;
+
+  // write policy. Stores sent on gather in line-sized entries of the
+  // write-combining buffer, which leave as one write when the buffer needs
+  // room for another line or a load misses on theirs; entries still
+  // buffered at the end are never sent.
+  bool write_through;
+  bool write_allocate;
+  struct wcb_entry_t {
+    uint64_t line;
+    size_t slot;
+  };
+  size_t wcb_entries;
+  fifo_t<wcb_entry_t> wcb;
+  // the bytes of its line each entry's stores wrote, linesz per slot, and
+  // the slots no entry holds
+  std::vector<uint8_t> wcb_written;
+  std::vector<size_t> wcb_free;
+  uint64_t write_through_bytes;
+  uint64_t write_around_bytes;
+  uint64_t wcb_merges;
+  uint64_t wcb_flushes;
+  uint64_t wcb_bytes;
+
+  // victim cache: packed lines this cache evicted, oldest first. A miss
+  // that finds its line there swaps it with the cache's own victim.
+  size_t vc_entries;
+  fifo_t<uint64_t> vc;
+  uint64_t vc_hits;
+
+  // sectored lines: valid and dirty sectors per line (NULL for whole
+  // lines), and those of the line fill_line last replaced. Only the
+  // sectors accessed are fetched, and only dirty ones are written back.
+  size_t sectorsz;
+  uint64_t* sector_valid;
+  uint64_t* sector_dirty;
+  uint64_t victim_valid_sectors;
+  uint64_t victim_dirty_sectors;
+  uint64_t sector_misses;
+
+  prefetcher_t* pf;
+  size_t pf_delay;
+  struct inflight_t {
+    uint64_t addr;
+    uint64_t ready;
+  };
+  // prefetches that arrive once ready accesses have been made
+  fifo_t<inflight_t> pf_inflight;
+  std::vector<uint64_t> pf_lines;
 
-  // an array to store the time stamp of each cache line
-  uint64_t* time_stamp;
-  // variable to store the current time
-  uint64_t curr_time;
+  miss_analyzer_t* analyzer;
+  set_sampler_t* sampler;
+  cache_timing_t* timing;
+  miss_attribution_t* attribution;
+  uint64_t pc;
+
+  // stats time series: the access count that ends the current interval,
+  // the records written, the instruction count (from count_insn, or as
+  // the last snapshot was given it) and the totals at the last record
+  std::shared_ptr<cache_stats_writer_t> stats_out;
+  size_t stats_interval;
+  uint64_t stats_next;
+  int64_t stats_records;
+  uint64_t stats_insns;
+  cache_stats_t stats_last;
+
+  coherence_bus_t* bus;
+  size_t hart;
+  uint64_t upgrades;
+  uint64_t coherence_invalidations;
+  uint64_t interventions;
+  uint64_t coherence_misses;
+  uint64_t false_sharing_misses;
 
   std::string name;
   bool log;
+  bool quiet;
 
   void init();
 };
 
+// Set-associative cache using replacement policy repl_t (see cacherepl.h)
+template <class repl_t>
+class sa_cache_sim_t : public cache_sim_t
+{
+ public:
+  sa_cache_sim_t(size_t sets, size_t ways, size_t linesz, const char* name)
+    : cache_sim_t(sets, ways, linesz, name)
+  {
+    repl.init(sets, ways);
+  }
+
+  void access(uint64_t addr, size_t bytes, bool store)
+  {
+    access_as<sa_cache_sim_t>(addr, bytes, store);
+  }
+
+  size_t check_tag(uint64_t addr)
+  {
+    size_t idx = (addr >> idx_shift) & (sets - 1);
+    size_t way = find_tag(&tags[idx * ways], ways, addr >> idx_shift);
+    if (way == ways)
+      return NO_LINE;
+
+    repl.touch(idx, way);
+    return idx * ways + way;
+  }
+
+  size_t probe_tag(uint64_t addr)
+  {
+    size_t idx = (addr >> idx_shift) & (sets - 1);
+    size_t way = find_tag(&tags[idx * ways], ways, addr >> idx_shift);
+    return way == ways ? NO_LINE : idx * ways + way;
+  }
+
+  size_t victimize(uint64_t addr, uint64_t& victim)
+  {
+    size_t idx = (addr >> idx_shift) & (sets - 1);
+    size_t way = repl.victim(idx);
+    repl.fill(idx, way);
+
+    victim = pack(idx * ways + way);
+    fill_line(idx * ways + way, addr >> idx_shift);
+    return idx * ways + way;
+  }
+
+  uint64_t invalidate(uint64_t addr)
+  {
+    size_t idx = (addr >> idx_shift) & (sets - 1);
+    size_t way = find_tag(&tags[idx * ways], ways, addr >> idx_shift);
+    if (way == ways)
+      return 0;
+
+    uint64_t old = pack(idx * ways + way);
+    fill_line(idx * ways + way, NO_TAG);
+    repl.invalidate(idx, way);
+    return old;
+  }
+
+ protected:
+  repl_t repl;
+};
+
+// Fully associative cache using replacement policy repl_t, with tags found
+// through a hash index instead of a scan over all ways
+template <class repl_t>
 class fa_cache_sim_t : public cache_sim_t
 {
  public:
-  fa_cache_sim_t(size_t ways, size_t linesz, const char* name);
-  uint64_t* check_tag(uint64_t addr);
-  uint64_t victimize(uint64_t addr);
- private:
-  static bool cmp(uint64_t a, uint64_t b);
-  std::map<uint64_t, uint64_t> tags;
+  fa_cache_sim_t(size_t ways, size_t linesz, const char* name)
+    : cache_sim_t(1, ways, linesz, name)
+  {
+    repl.init(1, ways);
+    index.init(ways);
+  }
+
+  void access(uint64_t addr, size_t bytes, bool store)
+  {
+    access_as<fa_cache_sim_t>(addr, bytes, store);
+  }
+
+  size_t check_tag(uint64_t addr)
+  {
+    size_t way = index.find((addr >> idx_shift) | VALID);
+    if (way == tag_index_t::NONE)
+      return NO_LINE;
+
+    repl.touch(0, way);
+    return way;
+  }
+
+  size_t probe_tag(uint64_t addr)
+  {
+    size_t way = index.find((addr >> idx_shift) | VALID);
+    return way == tag_index_t::NONE ? NO_LINE : way;
+  }
+
+  size_t victimize(uint64_t addr, uint64_t& victim)
+  {
+    size_t way = repl.victim(0);
+    repl.fill(0, way);
+
+    // read the victim before overwriting it, so dirty lines are written back
+    victim = pack(way);
+    fill_line(way, addr >> idx_shift);
+
+    if (victim & VALID)
+      index.erase(victim & ~STATUS);
+    index.insert(tags[way] | VALID, way);
+
+    return way;
+  }
+
+  uint64_t invalidate(uint64_t addr)
+  {
+    uint64_t tag = (addr >> idx_shift) | VALID;
+    size_t way = index.find(tag);
+    if (way == tag_index_t::NONE)
+      return 0;
+
+    uint64_t old = pack(way);
+    fill_line(way, NO_TAG);
+    index.erase(tag);
+    repl.invalidate(0, way);
+    return old;
+  }
+
+ protected:
+  repl_t repl;
+  // tag -> way, kept in sync with the tags array by victimize
+  tag_index_t index;
 };
 
 class cache_memtracer_t : public memtracer_t
@@ -99,6 +771,18 @@ class cache_memtracer_t : public memtracer_t
   {
     cache->set_log(log);
   }
+  void set_bus(coherence_bus_t* bus)
+  {
+    cache->set_bus(bus);
+  }
+  void snapshot(uint64_t insns)
+  {
+    cache->snapshot(insns);
+  }
+  cache_sim_t* get_cache()
+  {
+    return cache;
+  }
 
  protected:
   cache_sim_t* cache;
@@ -114,7 +798,11 @@ class icache_sim_t : public cache_memtracer_t
   }
   void trace(uint64_t addr, size_t bytes, access_type type)
   {
-    if (type == FETCH) cache->access(addr, bytes, false);
+    if (type == FETCH) {
+      cache->set_pc(addr);
+      cache->access(addr, bytes, false);
+      cache->count_insn();
+    }
   }
 };
 
@@ -122,13 +810,115 @@ class dcache_sim_t : public cache_memtracer_t
 {
  public:
   dcache_sim_t(const char* config) : cache_memtracer_t(config, "D$") {}
+  // spike does not tell memtracers the PC, so the loads and stores of a
+  // hart are charged to the instruction it fetched last
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
+  {
+    return type == LOAD || type == STORE || (type == FETCH && cache->wants_pc());
+  }
+  void trace(uint64_t addr, size_t bytes, access_type type)
+  {
+    if (type == FETCH) {
+      cache->set_pc(addr);
+      cache->count_insn();
+    } else {
+      cache->access(addr, bytes, type == STORE);
+    }
+  }
+};
+
+// Computes exact LRU stats for every associativity up to max_ways of a
+// (sets, linesz) geometry in one pass. Each set keeps an LRU stack of
+// max_ways lines; an access that hits at depth d hits in every cache with
+// more than d ways, and a dirty line pushed down to depth w is written back
+// by the w-way cache. Each stack entry remembers the deepest depth it has
+// been pushed to since its last store, so it only counts once per cache.
+class stack_dist_sim_t
+{
+ public:
+  stack_dist_sim_t(size_t sets, size_t max_ways, size_t linesz);
+
+  void access(uint64_t addr, size_t bytes, bool store);
+  cache_stats_t stats(size_t ways) const;
+
+  size_t get_sets() const { return sets; }
+  size_t get_linesz() const { return linesz; }
+  size_t get_max_ways() const { return ways; }
+
+ private:
+  static const uint64_t VALID = 1ULL << 63;
+  static const uint32_t CLEAN = UINT32_MAX;
+
+  size_t sets;
+  size_t ways;
+  size_t linesz;
+  size_t idx_shift;
+
+  // per-set LRU stacks, MRU first; empty entries are zero
+  std::vector<uint64_t> stack;
+  // depth the line has been written back down to since its last store
+  std::vector<uint32_t> dirty_depth;
+
+  // hits at each stack depth, and writebacks out of each way count
+  std::vector<uint64_t> read_hits;
+  std::vector<uint64_t> write_hits;
+  std::vector<uint64_t> writebacks;
+
+  uint64_t read_accesses;
+  uint64_t bytes_read;
+  uint64_t write_accesses;
+  uint64_t bytes_written;
+};
+
+// Simulates a comma-separated list of LRU configurations at once, e.g.
+// "1:256:64,2:128:64,4:64:64". Only configurations that share both sets
+// and block size share one stack_dist_sim_t; the others get one each, so a
+// list of one geometry per set count shares nothing. Every configuration's
+// stats are printed as "<name>[sets:ways:blocksize]" when the tracer is
+// destroyed.
+class cache_sweep_memtracer_t : public memtracer_t
+{
+ public:
+  cache_sweep_memtracer_t(const char* configs, const char* name);
+  ~cache_sweep_memtracer_t();
+
+ protected:
+  void access(uint64_t addr, size_t bytes, bool store)
+  {
+    for (auto group : groups)
+      group->access(addr, bytes, store);
+  }
+
+  std::vector<stack_dist_sim_t*> groups;
+  std::vector<std::pair<cache_config_t, stack_dist_sim_t*>> configs;
+  std::string name;
+};
+
+class icache_sweep_sim_t : public cache_sweep_memtracer_t
+{
+ public:
+  icache_sweep_sim_t(const char* configs) : cache_sweep_memtracer_t(configs, "I$") {}
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
+  {
+    return type == FETCH;
+  }
+  void trace(uint64_t addr, size_t bytes, access_type type)
+  {
+    if (type == FETCH) access(addr, bytes, false);
+  }
+};
+
+class dcache_sweep_sim_t : public cache_sweep_memtracer_t
+{
+ public:
+  dcache_sweep_sim_t(const char* configs) : cache_sweep_memtracer_t(configs, "D$") {}
   bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
   {
     return type == LOAD || type == STORE;
   }
   void trace(uint64_t addr, size_t bytes, access_type type)
   {
-    if (type == LOAD || type == STORE) cache->access(addr, bytes, type == STORE);
+    if (type == LOAD || type == STORE) access(addr, bytes, type == STORE);
   }
 };
 
@@ -0,0 +1,95 @@
+// See LICENSE for license details.
+
+// Measures how long cache_sim_t takes per access on synthetic address
+// streams, to check changes to the simulator's hot path. The addresses
+// are generated up front, so only the simulation itself is timed.
+
+#include "cachesim.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+static void help() {
+    std::cerr << "usage: cachesim_bench [options]" << std::endl;
+    std::cerr << "  --configs=<S:W:B,...>  Configurations to measure (default: 64:4:64,256:8:64," << std::endl;
+    std::cerr << "                         512:16:64,64:16:64:srrip,1:1024:64)" << std::endl;
+    std::cerr << "  --accesses=<n>         Accesses per stream and configuration (default 10000000)" << std::endl;
+    std::cerr << "  --footprint=<n>        Bytes each stream covers, as a multiple of the cache" << std::endl;
+    std::cerr << "                         size (default 2)" << std::endl;
+    exit(1);
+}
+
+static const char *option(const char *arg, const char *name) {
+    size_t n = strlen(name);
+    return strncmp(arg, name, n) == 0 ? arg + n : NULL;
+}
+
+// One in four accesses is a store. The streams are
+//   random:  8-byte accesses anywhere in the footprint
+//   strided: one access every 4 KiB plus a line, wrapping around
+//   looping: 8-byte accesses walking through the footprint again and again
+static std::vector<uint64_t> make_stream(const std::string &kind, size_t n, uint64_t footprint) {
+    std::vector<uint64_t> addrs(n);
+    uint64_t x = 1, a = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (kind == "random") {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            a = ((x >> 16) % footprint) & ~7ULL;
+        } else if (kind == "strided") {
+            a = (a + 4096 + 64) % footprint;
+        } else {
+            a = (a + 8) % footprint;
+        }
+        addrs[i] = a | (i % 4 == 3);
+    }
+    return addrs;
+}
+
+int main(int argc, char **argv) {
+    std::string configs = "64:4:64,256:8:64,512:16:64,64:16:64:srrip,1:1024:64";
+    size_t n = 10000000;
+    uint64_t scale = 2;
+    for (int i = 1; i < argc; i++) {
+        const char *s;
+        if ((s = option(argv[i], "--configs=")))
+            configs = s;
+        else if ((s = option(argv[i], "--accesses=")) && atoll(s) > 0)
+            n = atoll(s);
+        else if ((s = option(argv[i], "--footprint=")) && atoll(s) > 0)
+            scale = atoll(s);
+        else
+            help();
+    }
+
+    std::cout << std::setprecision(2) << std::fixed;
+    std::cout << "config,stream,ns_per_access,miss_rate" << std::endl;
+    for (size_t p = 0; p <= configs.size();) {
+        size_t e = configs.find(',', p);
+        if (e == std::string::npos)
+            e = configs.size();
+        std::string config = configs.substr(p, e - p);
+        p = e + 1;
+
+        cache_config_t c = cache_config_t::parse(config.c_str());
+        for (const char *kind : {"random", "strided", "looping"}) {
+            std::vector<uint64_t> addrs = make_stream(kind, n, scale * c.sets * c.ways * c.linesz);
+            std::unique_ptr<cache_sim_t> cache(cache_sim_t::construct(config.c_str(), "D$"));
+            cache->set_quiet(true);
+
+            auto start = std::chrono::steady_clock::now();
+            for (uint64_t a : addrs)
+                cache->access(a & ~1ULL, 8, a & 1);
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+            cache_stats_t s = cache->stats();
+            std::cout << config << "," << kind << "," << ns / n << ","
+                      << 100.0 * (s.read_misses + s.write_misses) / n << std::endl;
+        }
+    }
+    return 0;
+}
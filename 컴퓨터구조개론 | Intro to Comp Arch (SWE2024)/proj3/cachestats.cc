@@ -0,0 +1,82 @@
+// See LICENSE for license details.
+
+#include "cachestats.h"
+#include <cstdlib>
+#include <iostream>
+#include <map>
+
+std::shared_ptr<cache_stats_writer_t> cache_stats_writer_t::open(const std::string &path) {
+    // cachesweep constructs caches from several threads, one after another
+    // on each, so files stay open until exit rather than being truncated
+    // when the next cache opens them again
+    static std::mutex open_lock;
+    static std::map<std::string, std::shared_ptr<cache_stats_writer_t>> files;
+    std::lock_guard<std::mutex> guard(open_lock);
+
+    std::shared_ptr<cache_stats_writer_t> &w = files[path];
+    if (w)
+        return w;
+
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) {
+        std::cerr << "could not open stats file " << path << std::endl;
+        exit(1);
+    }
+    bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+    if (csv) {
+        fprintf(file, "cache,record,insns,end,accesses,misses,miss_rate,read_misses,write_misses,"
+                      "writebacks,amat\n");
+    }
+    w.reset(new cache_stats_writer_t(file, csv));
+    return w;
+}
+
+cache_stats_writer_t::cache_stats_writer_t(FILE *_file, bool _csv) : file(_file), csv(_csv) {
+}
+
+cache_stats_writer_t::~cache_stats_writer_t() {
+    fclose(file);
+}
+
+void cache_stats_writer_t::write(const std::string &cache, int64_t record, uint64_t insns, uint64_t end,
+                                 const cache_stats_t &s) {
+    uint64_t accesses = s.read_accesses + s.write_accesses;
+    uint64_t misses = s.read_misses + s.write_misses;
+    double miss_rate = accesses ? 100.0 * misses / accesses : 0;
+    double amat = accesses ? double(s.latency_cycles) / accesses : 0;
+    std::string rec = record < 0 ? "summary" : std::to_string(record);
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (csv) {
+        fprintf(file, "%s,%s,%llu,%llu,%llu,%llu,%.3f,%llu,%llu,%llu,%.3f\n", cache.c_str(), rec.c_str(),
+                (unsigned long long)insns, (unsigned long long)end, (unsigned long long)accesses,
+                (unsigned long long)misses, miss_rate, (unsigned long long)s.read_misses,
+                (unsigned long long)s.write_misses, (unsigned long long)s.writebacks, amat);
+    } else {
+        fprintf(file,
+                "{\"cache\": %s, \"record\": %s%s%s, \"insns\": %llu, \"end\": %llu, \"accesses\": %llu, "
+                "\"misses\": %llu, \"miss_rate\": %.3f, \"read_misses\": %llu, \"write_misses\": %llu, "
+                "\"writebacks\": %llu, \"amat\": %.3f}\n",
+                json_string(cache).c_str(), record < 0 ? "\"" : "", rec.c_str(), record < 0 ? "\"" : "",
+                (unsigned long long)insns, (unsigned long long)end, (unsigned long long)accesses,
+                (unsigned long long)misses, miss_rate, (unsigned long long)s.read_misses,
+                (unsigned long long)s.write_misses, (unsigned long long)s.writebacks, amat);
+    }
+}
+
+std::string json_string(const std::string &s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof esc, "\\u%04x", c);
+            out += esc;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
@@ -0,0 +1,42 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_CACHE_STATS_H
+#define _RISCV_CACHE_STATS_H
+
+#include "cachesim.h"
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Stats time series file. Caches write a record for every interval they
+// complete, with the counts of that interval alone, and a summary record
+// with their totals when they are destroyed. A path ending in .csv gets
+// CSV with a header line, anything else JSON Lines (one object per line).
+// Caches given the same path share the file, telling their records apart
+// by the cache column.
+class cache_stats_writer_t
+{
+ public:
+  static std::shared_ptr<cache_stats_writer_t> open(const std::string& path);
+  ~cache_stats_writer_t();
+
+  // record is the interval number, or -1 for the summary; insns is the
+  // instruction count the interval ended at, if the caller counts them,
+  // and end the cache's access count at that point
+  void write(const std::string& cache, int64_t record, uint64_t insns, uint64_t end,
+             const cache_stats_t& s);
+
+ private:
+  cache_stats_writer_t(FILE* file, bool csv);
+
+  FILE* file;
+  bool csv;
+  std::mutex lock;
+};
+
+// s as a JSON string literal, with quotes, backslashes and control
+// characters escaped
+std::string json_string(const std::string& s);
+
+#endif
@@ -0,0 +1,167 @@
+// See LICENSE for license details.
+
+// Runs every (trace, configuration) pair of a cache configuration sweep on
+// a pool of worker threads. Each trace is mapped once and shared read-only
+// by all workers; each job owns a private cache_sim_t. The results are
+// printed as one CSV or JSON table, in trace then configuration order.
+
+#include "cachesim.h"
+#include "cachestats.h"
+#include "cachetrace.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void help() {
+    std::cerr << "usage: cachesweep [options] <trace file>..." << std::endl;
+    std::cerr << "  --configs=<S:W:B,...>  Configurations to simulate" << std::endl;
+    std::cerr << "                         (default: the nine 64B-line configurations of goal 1)" << std::endl;
+    std::cerr << "  --threads=<n>          Worker threads (default: one per core)" << std::endl;
+    std::cerr << "  --ic                   Simulate instruction fetches instead of loads/stores" << std::endl;
+    std::cerr << "  --format=csv|json      Output format (default: csv)" << std::endl;
+    std::cerr << "Add :analyze=1 to a configuration to fill in its compulsory, capacity and" << std::endl;
+    std::cerr << "conflict miss columns, and :lat=<n> to fill in amat and stall_cycles." << std::endl;
+    exit(1);
+}
+
+static const char *option(const char *arg, const char *name) {
+    size_t n = strlen(name);
+    return strncmp(arg, name, n) == 0 ? arg + n : NULL;
+}
+
+// trace file name without directories and extension
+static std::string app_name(const char *path) {
+    const char *base = strrchr(path, '/');
+    std::string app = base ? base + 1 : path;
+    return app.substr(0, app.find('.'));
+}
+
+struct job_t {
+    size_t trace;
+    std::string config;
+    cache_stats_t stats;
+};
+
+static void run(job_t &job, const cache_trace_t &trace, bool fetch) {
+    // named after the configuration, for stats files shared between them
+    std::string name = std::string(fetch ? "I$" : "D$") + "[" + job.config + "]";
+    std::unique_ptr<cache_sim_t> cache(cache_sim_t::construct(job.config.c_str(), name.c_str()));
+    cache->set_quiet(true);
+
+    cache_trace_reader_t reader(trace);
+    uint64_t addr;
+    size_t bytes;
+    access_type type;
+    while (reader.next(addr, bytes, type)) {
+        if (type == FETCH)
+            cache->count_insn();
+        if (fetch ? type == FETCH : type != FETCH)
+            cache->access(addr, bytes, type == STORE);
+    }
+
+    job.stats = cache->stats();
+}
+
+int main(int argc, char **argv) {
+    std::string configs = "1:256:64,2:128:64,4:64:64,8:32:64,16:16:64,32:8:64,64:4:64,128:2:64,256:1:64";
+    size_t nthreads = std::thread::hardware_concurrency();
+    bool fetch = false;
+    bool json = false;
+    std::vector<const char *> paths;
+
+    for (int i = 1; i < argc; i++) {
+        const char *s;
+        if ((s = option(argv[i], "--configs=")))
+            configs = s;
+        else if ((s = option(argv[i], "--threads=")))
+            nthreads = atoi(s);
+        else if (!strcmp(argv[i], "--ic"))
+            fetch = true;
+        else if ((s = option(argv[i], "--format=")) && (!strcmp(s, "csv") || !strcmp(s, "json")))
+            json = !strcmp(s, "json");
+        else if (argv[i][0] == '-')
+            help();
+        else
+            paths.push_back(argv[i]);
+    }
+    if (paths.empty())
+        help();
+    if (nthreads == 0)
+        nthreads = 1;
+
+    std::vector<std::string> config_list;
+    for (size_t p = 0; p <= configs.size();) {
+        size_t e = configs.find(',', p);
+        if (e == std::string::npos)
+            e = configs.size();
+        config_list.push_back(configs.substr(p, e - p));
+        // reject bad configurations before starting any worker
+        delete cache_sim_t::construct(config_list.back().c_str(), "D$");
+        p = e + 1;
+    }
+
+    std::vector<std::unique_ptr<cache_trace_t>> traces;
+    std::vector<job_t> jobs;
+    for (size_t t = 0; t < paths.size(); t++) {
+        traces.emplace_back(new cache_trace_t(paths[t]));
+        for (auto &config : config_list)
+            jobs.push_back(job_t{t, config, cache_stats_t()});
+    }
+
+    std::atomic<size_t> next_job(0);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min(nthreads, jobs.size()); i++) {
+        workers.emplace_back([&]() {
+            for (size_t j; (j = next_job++) < jobs.size();)
+                run(jobs[j], *traces[jobs[j].trace], fetch);
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+
+    std::cout << std::setprecision(3) << std::fixed;
+    if (json)
+        std::cout << "[" << std::endl;
+    else
+        std::cout << "app,config,accesses,misses,miss_rate,writebacks,bytes_read,bytes_written,fill_bytes,writeback_bytes,"
+                  << "compulsory,capacity,conflict,amat,stall_cycles" << std::endl;
+
+    for (size_t j = 0; j < jobs.size(); j++) {
+        const cache_stats_t &s = jobs[j].stats;
+        uint64_t accesses = s.read_accesses + s.write_accesses;
+        uint64_t misses = s.read_misses + s.write_misses;
+        double mr = accesses ? 100.0 * misses / accesses : 0;
+        double amat = accesses ? double(s.latency_cycles) / accesses : 0;
+        std::string app = app_name(paths[jobs[j].trace]);
+
+        if (json) {
+            std::cout << "  {\"app\": " << json_string(app) << ", \"config\": " << json_string(jobs[j].config)
+                      << ", \"accesses\": " << accesses << ", \"misses\": " << misses
+                      << ", \"miss_rate\": " << mr << ", \"writebacks\": " << s.writebacks
+                      << ", \"bytes_read\": " << s.bytes_read << ", \"bytes_written\": " << s.bytes_written
+                      << ", \"fill_bytes\": " << s.fill_bytes
+                      << ", \"writeback_bytes\": " << s.writeback_bytes
+                      << ", \"compulsory\": " << s.compulsory_misses << ", \"capacity\": " << s.capacity_misses
+                      << ", \"conflict\": " << s.conflict_misses << ", \"amat\": " << amat
+                      << ", \"stall_cycles\": " << s.stall_cycles << "}"
+                      << (j + 1 < jobs.size() ? "," : "") << std::endl;
+        } else {
+            std::cout << app << "," << jobs[j].config << "," << accesses << "," << misses << ","
+                      << mr << "," << s.writebacks << "," << s.bytes_read << "," << s.bytes_written << ","
+                      << s.fill_bytes << "," << s.writeback_bytes << "," << s.compulsory_misses << ","
+                      << s.capacity_misses << "," << s.conflict_misses << "," << amat << "," << s.stall_cycles
+                      << std::endl;
+        }
+    }
+
+    if (json)
+        std::cout << "]" << std::endl;
+    return 0;
+}
@@ -0,0 +1,61 @@
+// See LICENSE for license details.
+
+#include "cachetrace.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char cache_trace_writer_t::MAGIC[8] = {'C', 'S', 'T', 'R', 'A', 'C', 'E', '1'};
+
+cache_trace_writer_t::cache_trace_writer_t(const char *path)
+    : pos(0), last{0, 0, 0}, last_hart(0) {
+    file = fopen(path, "wb");
+    if (!file) {
+        std::cerr << "could not open trace file " << path << std::endl;
+        exit(1);
+    }
+    memcpy(buf, MAGIC, sizeof(MAGIC));
+    pos = sizeof(MAGIC);
+}
+
+cache_trace_writer_t::~cache_trace_writer_t() {
+    flush();
+    fclose(file);
+}
+
+void cache_trace_writer_t::flush() {
+    if (fwrite(buf, 1, pos, file) != pos) {
+        std::cerr << "error writing trace file" << std::endl;
+        exit(1);
+    }
+    pos = 0;
+}
+
+cache_trace_t::cache_trace_t(const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        std::cerr << "could not open trace file " << path << std::endl;
+        exit(1);
+    }
+
+    len = st.st_size;
+    void *p = len ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (p == MAP_FAILED || len < sizeof(cache_trace_writer_t::MAGIC) ||
+        memcmp(p, cache_trace_writer_t::MAGIC, sizeof(cache_trace_writer_t::MAGIC))) {
+        std::cerr << path << " is not a cache trace" << std::endl;
+        exit(1);
+    }
+
+    data = static_cast<const uint8_t *>(p);
+    madvise(p, len, MADV_SEQUENTIAL);
+}
+
+cache_trace_t::~cache_trace_t() {
+    munmap(const_cast<uint8_t *>(data), len);
+}
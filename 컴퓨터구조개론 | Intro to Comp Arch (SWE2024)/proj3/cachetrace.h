@@ -0,0 +1,161 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_CACHE_TRACE_H
+#define _RISCV_CACHE_TRACE_H
+
+#include "memtracer.h"
+#include "common.h"
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+// Compact binary memory trace. After the 8-byte magic, every access is one
+// header byte followed by the zigzag varint difference from the previous
+// address of the same access type. The header holds the access_type in
+// bits 0-1 and log2 of the size in bits 2-4; sizes that are not a power of
+// two up to 64 store 7 there and follow the header as a varint.
+// Sequential fetches and small-stride loads take two bytes per access.
+// A header with type 3 switches harts: the accesses after it, up to the
+// next switch, come from the hart whose id follows as a varint. Traces
+// start out on hart 0, so single-hart traces have no switches.
+
+class cache_trace_writer_t
+{
+ public:
+  static const char MAGIC[8];
+  static const uint8_t HART = 3;
+
+  cache_trace_writer_t(const char* path);
+  ~cache_trace_writer_t();
+
+  void write(uint64_t addr, size_t bytes, access_type type, size_t hart = 0)
+  {
+    // hart switch + header + size varint + delta varint
+    if (pos + 32 > sizeof(buf))
+      flush();
+
+    if (unlikely(hart != last_hart)) {
+      buf[pos++] = HART;
+      put_varint(hart);
+      last_hart = hart;
+    }
+
+    unsigned log2 = 0;
+    while (log2 < 7 && (size_t(1) << log2) < bytes)
+      log2++;
+    if (log2 == 7 || (size_t(1) << log2) != bytes)
+      log2 = 7;
+
+    buf[pos++] = type | (log2 << 2);
+    if (log2 == 7)
+      put_varint(bytes);
+
+    uint64_t delta = addr - last[type];
+    last[type] = addr;
+    put_varint((delta << 1) ^ -(delta >> 63));
+  }
+  void flush();
+
+ private:
+  void put_varint(uint64_t x)
+  {
+    for (; x >= 0x80; x >>= 7)
+      buf[pos++] = x | 0x80;
+    buf[pos++] = x;
+  }
+
+  FILE* file;
+  uint8_t buf[1 << 16];
+  size_t pos;
+  uint64_t last[3];
+  size_t last_hart;
+};
+
+// A trace file mapped read-only into memory. Any number of readers may
+// walk it at once.
+class cache_trace_t
+{
+ public:
+  cache_trace_t(const char* path);
+  cache_trace_t(const cache_trace_t&) = delete;
+  ~cache_trace_t();
+
+  const uint8_t* begin() const { return data + sizeof(cache_trace_writer_t::MAGIC); }
+  const uint8_t* end() const { return data + len; }
+
+ private:
+  const uint8_t* data;
+  size_t len;
+};
+
+class cache_trace_reader_t
+{
+ public:
+  cache_trace_reader_t(const cache_trace_t& trace)
+    : p(trace.begin()), end(trace.end()), last{0, 0, 0}, cur_hart(0) {}
+
+  bool next(uint64_t& addr, size_t& bytes, access_type& type)
+  {
+    while (p < end && *p == cache_trace_writer_t::HART) {
+      p++;
+      cur_hart = get_varint();
+    }
+    if (p >= end)
+      return false;
+
+    uint8_t h = *p++;
+    type = access_type(h & 3);
+    unsigned log2 = (h >> 2) & 7;
+    bytes = log2 == 7 ? get_varint() : size_t(1) << log2;
+
+    uint64_t z = get_varint();
+    addr = last[type] += (z >> 1) ^ -(z & 1);
+    return true;
+  }
+  // the hart of the access next returned last
+  size_t hart() const { return cur_hart; }
+
+ private:
+  uint64_t get_varint()
+  {
+    uint64_t x = 0;
+    for (unsigned shift = 0; p < end; shift += 7) {
+      uint8_t b = *p++;
+      x |= uint64_t(b & 0x7f) << shift;
+      if (!(b & 0x80))
+        break;
+    }
+    return x;
+  }
+
+  const uint8_t* p;
+  const uint8_t* end;
+  uint64_t last[3];
+  size_t cur_hart;
+};
+
+// Records every access the simulator traces into a trace file. Spike's
+// memtracers are not told the hart, so multi-hart traces register one
+// memtracer per hart, each made from hart 0's.
+class cache_trace_memtracer_t : public memtracer_t
+{
+ public:
+  cache_trace_memtracer_t(const char* path) : writer(new cache_trace_writer_t(path)), hart(0) {}
+  cache_trace_memtracer_t(const cache_trace_memtracer_t& hart0, size_t _hart)
+    : writer(hart0.writer), hart(_hart) {}
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
+  {
+    return true;
+  }
+  void trace(uint64_t addr, size_t bytes, access_type type)
+  {
+    writer->write(addr, bytes, type, hart);
+  }
+
+ private:
+  std::shared_ptr<cache_trace_writer_t> writer;
+  size_t hart;
+};
+
+#endif
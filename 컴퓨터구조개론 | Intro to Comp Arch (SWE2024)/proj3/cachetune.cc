@@ -0,0 +1,421 @@
+// See LICENSE for license details.
+
+// Searches sets x ways x block size x replacement policy for the cache
+// configurations worth building for each trace: the Pareto front of miss
+// rate against hardware cost, under a cost budget. LRU candidates come
+// from one stack_dist_sim_t pass per (sets, block size), which covers
+// every associativity at once. The other policies are replayed through
+// cache_sim_t, cheapest first, and a replay stops as soon as it has more
+// misses than a candidate of no greater cost already has in total, since
+// it can only be dominated from there on.
+
+#include "cachesim.h"
+#include "cachestats.h"
+#include "cachetrace.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+static void help() {
+    std::cerr << "usage: cachetune [options] <trace file>..." << std::endl;
+    std::cerr << "  --budget=<bytes>        Largest hardware cost to consider (default 32768)" << std::endl;
+    std::cerr << "  --cost=area|capacity    Cost of a cache: its data, tag and state bits (default)," << std::endl;
+    std::cerr << "                          or its data bytes alone" << std::endl;
+    std::cerr << "  --linesz=<B,...>        Block sizes to try (default 16,32,64,128)" << std::endl;
+    std::cerr << "  --max-ways=<n>          Largest associativity to try; ways and sets are" << std::endl;
+    std::cerr << "                          powers of two (default 16)" << std::endl;
+    std::cerr << "  --policies=<p,...>      Replacement policies to try (default lru,fifo,random," << std::endl;
+    std::cerr << "                          plru,srrip,brrip,lfu)" << std::endl;
+    std::cerr << "  --threads=<n>           Worker threads (default: one per core)" << std::endl;
+    std::cerr << "  --ic                    Tune for instruction fetches instead of loads/stores" << std::endl;
+    std::cerr << "  --all                   Print every candidate, not just the Pareto front" << std::endl;
+    std::cerr << "  --format=csv|json       Output format (default: csv)" << std::endl;
+    exit(1);
+}
+
+static const char *option(const char *arg, const char *name) {
+    size_t n = strlen(name);
+    return strncmp(arg, name, n) == 0 ? arg + n : NULL;
+}
+
+static std::vector<std::string> split(const std::string &list) {
+    std::vector<std::string> items;
+    for (size_t p = 0; p <= list.size();) {
+        size_t e = list.find(',', p);
+        if (e == std::string::npos)
+            e = list.size();
+        items.push_back(list.substr(p, e - p));
+        p = e + 1;
+    }
+    return items;
+}
+
+static size_t ilog2(size_t x) {
+    size_t n = 0;
+    while ((size_t(1) << n) < x)
+        n++;
+    return n;
+}
+
+// trace file name without directories and extension
+static std::string app_name(const char *path) {
+    const char *base = strrchr(path, '/');
+    std::string app = base ? base + 1 : path;
+    return app.substr(0, app.find('.'));
+}
+
+// Storage bits of a cache with 56-bit (RV64 physical) addresses: per line
+// the data, the tag, a valid and a dirty bit, plus the replacement state,
+// which is an LRU rank or two RRPV bits or an 8-bit frequency counter per
+// line, a FIFO pointer or PLRU tree per set, and nothing for random.
+static uint64_t area_bits(size_t sets, size_t ways, size_t linesz, const std::string &policy) {
+    const size_t ADDR_BITS = 56;
+    uint64_t line = linesz * 8 + (ADDR_BITS - ilog2(sets) - ilog2(linesz)) + 2;
+    uint64_t set = 0;
+    if (policy == "lru")
+        line += ilog2(ways);
+    else if (policy == "srrip" || policy == "brrip")
+        line += 2;
+    else if (policy == "lfu")
+        line += 8;
+    else if (policy == "fifo")
+        set = ilog2(ways);
+    else if (policy == "plru")
+        set = ways - 1;
+    return sets * (ways * line + set);
+}
+
+struct candidate_t {
+    size_t trace;
+    size_t sets;
+    size_t ways;
+    size_t linesz;
+    std::string policy;
+    uint64_t cost;
+
+    enum { PENDING, DONE, PRUNED } status;
+    uint64_t accesses;
+    uint64_t misses;
+    bool front;
+
+    std::string config() const {
+        std::string c = std::to_string(sets) + ":" + std::to_string(ways) + ":" + std::to_string(linesz);
+        return policy == "lru" ? c : c + ":" + policy;
+    }
+};
+
+// What has been learned about one trace so far: the misses of every
+// finished candidate, and the compulsory misses at each block size
+struct trace_state_t {
+    std::mutex lock;
+    std::vector<std::pair<uint64_t, uint64_t>> done;
+    std::vector<std::pair<size_t, uint64_t>> compulsory;
+
+    void finish(uint64_t cost, uint64_t misses) {
+        std::lock_guard<std::mutex> guard(lock);
+        done.push_back(std::make_pair(cost, misses));
+    }
+
+    // fewest misses of any finished candidate costing no more than cost
+    uint64_t bound(uint64_t cost) {
+        std::lock_guard<std::mutex> guard(lock);
+        uint64_t b = UINT64_MAX;
+        for (auto &d : done) {
+            if (d.first <= cost)
+                b = std::min(b, d.second);
+        }
+        return b;
+    }
+};
+
+static bool wanted(access_type type, bool fetch) {
+    return fetch ? type == FETCH : type != FETCH;
+}
+
+// One LRU stack pass covering candidates[first, last), which share sets
+// and block size, and for sets == 1 also the compulsory misses, which
+// every cache with this block size takes
+static void run_stack(std::vector<candidate_t> &cands, size_t first, size_t last, const cache_trace_t &trace,
+                      trace_state_t &state, bool fetch) {
+    const candidate_t &c = cands[first];
+    size_t max_ways = 0;
+    for (size_t i = first; i < last; i++)
+        max_ways = std::max(max_ways, cands[i].ways);
+    stack_dist_sim_t stack(c.sets, max_ways, c.linesz);
+
+    std::unordered_set<uint64_t> lines;
+    cache_trace_reader_t reader(trace);
+    uint64_t addr;
+    size_t bytes;
+    access_type type;
+    while (reader.next(addr, bytes, type)) {
+        if (!wanted(type, fetch))
+            continue;
+        stack.access(addr, bytes, type == STORE);
+        if (c.sets == 1)
+            lines.insert(addr / c.linesz);
+    }
+
+    for (size_t i = first; i < last; i++) {
+        cache_stats_t s = stack.stats(cands[i].ways);
+        cands[i].accesses = s.read_accesses + s.write_accesses;
+        cands[i].misses = s.read_misses + s.write_misses;
+        cands[i].status = candidate_t::DONE;
+        state.finish(cands[i].cost, cands[i].misses);
+    }
+    if (c.sets == 1) {
+        std::lock_guard<std::mutex> guard(state.lock);
+        state.compulsory.push_back(std::make_pair(c.linesz, lines.size()));
+    }
+}
+
+// Replays one non-LRU candidate, giving up once it is dominated
+static void run_replay(candidate_t &c, const cache_trace_t &trace, trace_state_t &state, bool fetch) {
+    const uint64_t CHECK = 1 << 16;
+
+    uint64_t bound = state.bound(c.cost);
+    {
+        std::lock_guard<std::mutex> guard(state.lock);
+        for (auto &comp : state.compulsory) {
+            if (comp.first == c.linesz && comp.second > bound) {
+                c.status = candidate_t::PRUNED;
+                return;
+            }
+        }
+    }
+
+    std::string config = c.config();
+    std::unique_ptr<cache_sim_t> cache(cache_sim_t::construct(config.c_str(), "D$"));
+    cache->set_quiet(true);
+
+    cache_trace_reader_t reader(trace);
+    uint64_t addr;
+    size_t bytes;
+    access_type type;
+    uint64_t n = 0;
+    while (reader.next(addr, bytes, type)) {
+        if (!wanted(type, fetch))
+            continue;
+        cache->access(addr, bytes, type == STORE);
+        if (++n % CHECK == 0) {
+            cache_stats_t s = cache->stats();
+            if (s.read_misses + s.write_misses > bound) {
+                bound = state.bound(c.cost);
+                if (s.read_misses + s.write_misses > bound) {
+                    c.status = candidate_t::PRUNED;
+                    c.accesses = n;
+                    c.misses = s.read_misses + s.write_misses;
+                    return;
+                }
+            }
+        }
+    }
+
+    cache_stats_t s = cache->stats();
+    c.accesses = s.read_accesses + s.write_accesses;
+    c.misses = s.read_misses + s.write_misses;
+    c.status = candidate_t::DONE;
+    state.finish(c.cost, c.misses);
+}
+
+int main(int argc, char **argv) {
+    uint64_t budget = 32768;
+    bool area = true;
+    std::string linesz_list = "16,32,64,128";
+    size_t max_ways = 16;
+    std::string policy_list = "lru,fifo,random,plru,srrip,brrip,lfu";
+    size_t nthreads = std::thread::hardware_concurrency();
+    bool fetch = false;
+    bool all = false;
+    bool json = false;
+    std::vector<const char *> paths;
+
+    for (int i = 1; i < argc; i++) {
+        const char *s;
+        if ((s = option(argv[i], "--budget=")) && atoll(s) > 0)
+            budget = atoll(s);
+        else if ((s = option(argv[i], "--cost=")) && (!strcmp(s, "area") || !strcmp(s, "capacity")))
+            area = !strcmp(s, "area");
+        else if ((s = option(argv[i], "--linesz=")))
+            linesz_list = s;
+        else if ((s = option(argv[i], "--max-ways=")) && atoi(s) > 0)
+            max_ways = atoi(s);
+        else if ((s = option(argv[i], "--policies=")))
+            policy_list = s;
+        else if ((s = option(argv[i], "--threads=")))
+            nthreads = atoi(s);
+        else if (!strcmp(argv[i], "--ic"))
+            fetch = true;
+        else if (!strcmp(argv[i], "--all"))
+            all = true;
+        else if ((s = option(argv[i], "--format=")) && (!strcmp(s, "csv") || !strcmp(s, "json")))
+            json = !strcmp(s, "json");
+        else if (argv[i][0] == '-')
+            help();
+        else
+            paths.push_back(argv[i]);
+    }
+    if (paths.empty())
+        help();
+    if (nthreads == 0)
+        nthreads = 1;
+
+    std::vector<size_t> lineszs;
+    for (auto &l : split(linesz_list)) {
+        lineszs.push_back(atoi(l.c_str()));
+        if (lineszs.back() < 8 || (lineszs.back() & (lineszs.back() - 1)))
+            help();
+    }
+    std::vector<std::string> policies = split(policy_list);
+    for (auto &p : policies) {
+        // reject unknown policies before starting any worker
+        delete cache_sim_t::construct(("1:2:64:" + p).c_str(), "D$");
+    }
+
+    // every candidate within the budget, LRU ones grouped by (sets, block
+    // size) for the stack passes; cost only grows with sets and ways
+    std::vector<candidate_t> cands;
+    std::vector<std::pair<size_t, size_t>> stack_jobs;
+    std::vector<size_t> replay_jobs;
+    auto cost = [&](size_t sets, size_t ways, size_t linesz, const std::string &policy) {
+        return area ? (area_bits(sets, ways, linesz, policy) + 7) / 8 : uint64_t(sets) * ways * linesz;
+    };
+    for (size_t t = 0; t < paths.size(); t++) {
+        for (size_t linesz : lineszs) {
+            for (size_t sets = 1; cost(sets, 1, linesz, "lru") <= budget; sets *= 2) {
+                size_t first = cands.size();
+                for (size_t ways = 1; ways <= max_ways; ways *= 2) {
+                    for (auto &p : policies) {
+                        // with one way every policy evicts the same line
+                        if (ways == 1 && p != "lru" && std::count(policies.begin(), policies.end(), "lru"))
+                            continue;
+                        uint64_t c = cost(sets, ways, linesz, p);
+                        if (c > budget)
+                            continue;
+                        cands.push_back(candidate_t{t, sets, ways, linesz, p, c, candidate_t::PENDING, 0, 0, false});
+                    }
+                }
+                // LRU candidates first within the group
+                std::stable_partition(cands.begin() + first, cands.end(),
+                                      [](const candidate_t &c) { return c.policy == "lru"; });
+                size_t last = first;
+                while (last < cands.size() && cands[last].policy == "lru")
+                    last++;
+                if (last > first)
+                    stack_jobs.push_back(std::make_pair(first, last));
+                for (size_t i = last; i < cands.size(); i++)
+                    replay_jobs.push_back(i);
+            }
+        }
+    }
+    // the cheapest replays first, so that they bound the dearer ones
+    std::stable_sort(replay_jobs.begin(), replay_jobs.end(),
+                     [&](size_t a, size_t b) { return cands[a].cost < cands[b].cost; });
+
+    std::vector<std::unique_ptr<cache_trace_t>> traces;
+    std::vector<std::unique_ptr<trace_state_t>> states;
+    for (size_t t = 0; t < paths.size(); t++) {
+        traces.emplace_back(new cache_trace_t(paths[t]));
+        states.emplace_back(new trace_state_t);
+    }
+
+    // all stack passes first: they are cheap and give the replays their bounds
+    std::atomic<size_t> next_job(0);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min(nthreads, stack_jobs.size() + replay_jobs.size()); i++) {
+        workers.emplace_back([&]() {
+            for (size_t j; (j = next_job++) < stack_jobs.size() + replay_jobs.size();) {
+                if (j < stack_jobs.size()) {
+                    size_t t = cands[stack_jobs[j].first].trace;
+                    run_stack(cands, stack_jobs[j].first, stack_jobs[j].second, *traces[t], *states[t], fetch);
+                } else {
+                    candidate_t &c = cands[replay_jobs[j - stack_jobs.size()]];
+                    run_replay(c, *traces[c.trace], *states[c.trace], fetch);
+                }
+            }
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+
+    // the front of each trace: by cost, every candidate with fewer misses
+    // than all cheaper ones
+    std::vector<size_t> order(cands.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        const candidate_t &x = cands[a], &y = cands[b];
+        if (x.trace != y.trace)
+            return x.trace < y.trace;
+        if (x.cost != y.cost)
+            return x.cost < y.cost;
+        return x.status == candidate_t::DONE && (y.status != candidate_t::DONE || x.misses < y.misses);
+    });
+    uint64_t best = UINT64_MAX;
+    for (size_t i = 0; i < order.size(); i++) {
+        candidate_t &c = cands[order[i]];
+        if (i == 0 || c.trace != cands[order[i - 1]].trace)
+            best = UINT64_MAX;
+        if (c.status == candidate_t::DONE && c.misses < best) {
+            c.front = true;
+            best = c.misses;
+        }
+    }
+
+    std::vector<size_t> replayed(paths.size()), pruned(paths.size());
+    for (size_t j : replay_jobs)
+        (cands[j].status == candidate_t::PRUNED ? pruned : replayed)[cands[j].trace]++;
+    for (size_t t = 0; t < paths.size(); t++) {
+        std::cerr << app_name(paths[t]) << ": " << replayed[t] + pruned[t] << " replays, " << pruned[t]
+                  << " pruned as dominated" << std::endl;
+    }
+
+    std::cout << std::setprecision(3) << std::fixed;
+    if (json)
+        std::cout << "[" << std::endl;
+    else
+        std::cout << "app,config,cost,capacity,accesses,misses,miss_rate" << (all ? ",status" : "") << std::endl;
+
+    std::vector<size_t> printed;
+    for (size_t i : order) {
+        if (all || cands[i].front)
+            printed.push_back(i);
+    }
+    for (size_t k = 0; k < printed.size(); k++) {
+        const candidate_t &c = cands[printed[k]];
+        std::string app = app_name(paths[c.trace]);
+        uint64_t capacity = uint64_t(c.sets) * c.ways * c.linesz;
+        double mr = c.accesses ? 100.0 * c.misses / c.accesses : 0;
+        // a pruned replay stopped partway, so its miss rate is only a lower bound
+        const char *status = c.front ? "front" : c.status == candidate_t::PRUNED ? "pruned" : "dominated";
+
+        if (json) {
+            std::cout << "  {\"app\": " << json_string(app) << ", \"config\": " << json_string(c.config())
+                      << ", \"cost\": " << c.cost
+                      << ", \"capacity\": " << capacity << ", \"accesses\": " << c.accesses
+                      << ", \"misses\": " << c.misses << ", \"miss_rate\": " << mr;
+            if (all)
+                std::cout << ", \"status\": \"" << status << "\"";
+            std::cout << "}" << (k + 1 < printed.size() ? "," : "") << std::endl;
+        } else {
+            std::cout << app << "," << c.config() << "," << c.cost << "," << capacity << "," << c.accesses << ","
+                      << c.misses << "," << mr;
+            if (all)
+                std::cout << "," << status;
+            std::cout << std::endl;
+        }
+    }
+
+    if (json)
+        std::cout << "]" << std::endl;
+    return 0;
+}
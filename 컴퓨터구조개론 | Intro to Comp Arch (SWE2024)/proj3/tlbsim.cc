@@ -0,0 +1,136 @@
+// See LICENSE for license details.
+
+#include "tlbsim.h"
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+static void help() {
+    std::cerr << "TLB configurations must be of the form" << std::endl;
+    std::cerr << "  entries:ways" << std::endl;
+    std::cerr << "where entries is a positive multiple of ways and entries / ways" << std::endl;
+    std::cerr << "is a power of two. Pages are 4k (default) or 2m." << std::endl;
+    exit(1);
+}
+
+page_walker_t::page_walker_t(cache_sim_t *_cache, const char *_name)
+    : cache(_cache), next_table(TABLE_BASE), walks(0), refs(0), ref_misses(0), name(_name), quiet(false) {
+}
+
+page_walker_t::~page_walker_t() {
+    if (!quiet)
+        print_stats();
+}
+
+// The table at level (2 is the root) for addresses whose VPN bits above
+// that level are vpn_prefix
+uint64_t page_walker_t::table(unsigned level, uint64_t vpn_prefix) {
+    uint64_t &t = tables[(uint64_t(level) << 60) | vpn_prefix];
+    if (!t) {
+        t = next_table;
+        next_table += 4096;
+    }
+    return t;
+}
+
+void page_walker_t::walk(uint64_t addr, unsigned page_shift) {
+    walks++;
+
+    uint64_t vpn = addr >> 12;
+    unsigned leaf = (page_shift - 12) / 9;
+    for (unsigned level = LEVELS - 1;; level--) {
+        uint64_t pte = table(level, vpn >> (9 * (level + 1))) + ((vpn >> (9 * level)) & 511) * 8;
+        refs++;
+        if (cache) {
+            uint64_t before = cache->read_misses();
+            cache->access(pte, 8, false);
+            ref_misses += cache->read_misses() - before;
+        }
+        if (level == leaf)
+            break;
+    }
+}
+
+void page_walker_t::print_stats() const {
+    if (walks == 0)
+        return;
+
+    std::cout << std::setprecision(3) << std::fixed;
+    std::cout << name << " ";
+    std::cout << "Page Walks:            " << walks << std::endl;
+    std::cout << name << " ";
+    std::cout << "PTE Reads:             " << refs << std::endl;
+    if (cache) {
+        std::cout << name << " ";
+        std::cout << "PTE Read Misses:       " << ref_misses << std::endl;
+    }
+}
+
+tlb_sim_t::tlb_sim_t(size_t entries, size_t _ways, unsigned _page_shift, const char *_name)
+    : sets(entries / _ways), ways(_ways), page_shift(_page_shift), tags(entries, NO_TAG),
+      miss_handler(NULL), walker(NULL), accesses(), misses(), name(_name), quiet(false) {
+    repl.init(sets, ways);
+}
+
+tlb_sim_t::~tlb_sim_t() {
+    if (!quiet)
+        print_stats();
+}
+
+tlb_sim_t *tlb_sim_t::construct(const char *config, const char *page, const char *name) {
+    const char *colon = strchr(config, ':');
+    if (!colon)
+        help();
+    size_t entries = atoi(config);
+    size_t ways = atoi(colon + 1);
+    if (ways == 0 || entries == 0 || entries % ways || ((entries / ways) & (entries / ways - 1)))
+        help();
+
+    unsigned page_shift = 12;
+    if (page && !strcmp(page, "2m"))
+        page_shift = 21;
+    else if (page && strcmp(page, "4k"))
+        help();
+    return new tlb_sim_t(entries, ways, page_shift, name);
+}
+
+void tlb_sim_t::translate(uint64_t addr, bool store) {
+    accesses[store]++;
+
+    uint64_t vpn = addr >> page_shift;
+    size_t set = vpn & (sets - 1);
+    size_t way = find_tag(&tags[set * ways], ways, vpn);
+    if (way != ways) {
+        repl.touch(set, way);
+        return;
+    }
+
+    misses[store]++;
+    if (miss_handler)
+        miss_handler->translate(addr, store);
+    else if (walker)
+        walker->walk(addr, page_shift);
+
+    way = repl.victim(set);
+    repl.fill(set, way);
+    tags[set * ways + way] = vpn;
+}
+
+void tlb_sim_t::print_stats() const {
+    uint64_t n = accesses[0] + accesses[1];
+    if (n == 0)
+        return;
+
+    std::cout << std::setprecision(3) << std::fixed;
+    std::cout << name << " ";
+    std::cout << "Read Accesses:         " << accesses[0] << std::endl;
+    std::cout << name << " ";
+    std::cout << "Write Accesses:        " << accesses[1] << std::endl;
+    std::cout << name << " ";
+    std::cout << "Read Misses:           " << misses[0] << std::endl;
+    std::cout << name << " ";
+    std::cout << "Write Misses:          " << misses[1] << std::endl;
+    std::cout << name << " ";
+    std::cout << "Miss Rate:             " << 100.0f * (misses[0] + misses[1]) / n << '%' << std::endl;
+}
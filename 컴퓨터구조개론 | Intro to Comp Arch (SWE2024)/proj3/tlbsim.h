@@ -0,0 +1,105 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_TLB_SIM_H
+#define _RISCV_TLB_SIM_H
+
+#include "cachesim.h"
+#include "cacherepl.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Sv39 page table walker. A 4 KiB page takes three levels of 512 8-byte
+// PTEs, a 2 MiB megapage two. Each table gets its own 4 KiB page at
+// TABLE_BASE the first time a walk needs it, so walks through the same
+// upper tables read the same PTE lines, as they would in a real page
+// table. Every PTE read goes to the given cache as an 8-byte load.
+class page_walker_t
+{
+ public:
+  page_walker_t(cache_sim_t* cache, const char* name);
+  ~page_walker_t();
+
+  void walk(uint64_t addr, unsigned page_shift);
+
+  void print_stats() const;
+  void set_quiet(bool _quiet) { quiet = _quiet; }
+
+ private:
+  static const uint64_t TABLE_BASE = 1ULL << 40;
+  static const unsigned LEVELS = 3;
+
+  uint64_t table(unsigned level, uint64_t vpn_prefix);
+
+  cache_sim_t* cache;
+  // (level, VPN bits above the level) -> table address
+  std::unordered_map<uint64_t, uint64_t> tables;
+  uint64_t next_table;
+
+  uint64_t walks;
+  uint64_t refs;
+  uint64_t ref_misses;
+
+  std::string name;
+  bool quiet;
+};
+
+// Set-associative LRU TLB of pages of 1 << page_shift bytes. A miss goes
+// to the next TLB level, or to the page walker after the last one.
+class tlb_sim_t
+{
+ public:
+  tlb_sim_t(size_t entries, size_t ways, unsigned page_shift, const char* name);
+  ~tlb_sim_t();
+
+  // config is entries:ways; page is 4k or 2m
+  static tlb_sim_t* construct(const char* config, const char* page, const char* name);
+
+  void translate(uint64_t addr, bool store);
+  void set_miss_handler(tlb_sim_t* mh) { miss_handler = mh; }
+  void set_walker(page_walker_t* _walker) { walker = _walker; }
+  unsigned get_page_shift() const { return page_shift; }
+
+  void print_stats() const;
+  void set_quiet(bool _quiet) { quiet = _quiet; }
+
+ private:
+  static const uint64_t NO_TAG = UINT64_MAX;
+
+  size_t sets;
+  size_t ways;
+  unsigned page_shift;
+  std::vector<uint64_t> tags;
+  lru_repl_t repl;
+
+  tlb_sim_t* miss_handler;
+  page_walker_t* walker;
+
+  uint64_t accesses[2];
+  uint64_t misses[2];
+
+  std::string name;
+  bool quiet;
+};
+
+// Translates the loads and stores of a hart ahead of its D$, so register
+// it with the MMU before the dcache_sim_t whose cache the walker reads
+// through
+class dtlb_sim_t : public memtracer_t
+{
+ public:
+  dtlb_sim_t(tlb_sim_t* _tlb) : tlb(_tlb) {}
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
+  {
+    return type == LOAD || type == STORE;
+  }
+  void trace(uint64_t addr, size_t bytes, access_type type)
+  {
+    if (type == LOAD || type == STORE) tlb->translate(addr, type == STORE);
+  }
+
+ private:
+  tlb_sim_t* tlb;
+};
+
+#endif